@@ -4,6 +4,40 @@ HEADER_TYPES = (".h", ".hpp", ".hxx")
 SOURCE_TYPES = (".c", ".cpp", ".cxx")
 ALL_TYPES = HEADER_TYPES + SOURCE_TYPES
 
+# Built into the standalone engine library, these must not depend on F4SE
+ENGINE_FILES = (
+	"include/BodyGenParser.h",
+	"include/CacheTrace.h",
+	"include/CountingAllocator.h",
+	"include/GeometryCache.h",
+	"include/LatencyHistogram.h",
+	"include/MeshDump.h",
+	"include/MeshTopology.h",
+	"include/MorphDeltas.h",
+	"include/MorphIds.h",
+	"include/MorphMatrix.h",
+	"include/Morpher.h",
+	"include/ShardedCache.h",
+	"include/StringHash.h",
+	"include/TriArena.h",
+	"include/TriReader.h",
+	"include/VertexCodec.h",
+	"include/half.hpp",
+	"include/kd_matcher.hpp",
+	"include/shape.hpp",
+	"src/BodyGenParser.cpp",
+	"src/CacheTrace.cpp",
+	"src/GeometryCache.cpp",
+	"src/MeshDump.cpp",
+	"src/MeshTopology.cpp",
+	"src/MorphIds.cpp",
+	"src/MorphMatrix.cpp",
+	"src/Morpher.cpp",
+	"src/TriArena.cpp",
+	"src/TriReader.cpp",
+	"src/VertexCodec.cpp",
+)
+
 def make_cmake():
 	tmp = list()
 	directories = ("src","include")
@@ -16,26 +50,33 @@ def make_cmake():
 
 	headers = list()
 	sources = list()
+	engine_headers = list()
+	engine_sources = list()
 	for file in tmp:
 		name = file.replace("\\", "/")
+		engine = name in ENGINE_FILES
 		if name.endswith(HEADER_TYPES):
-			headers.append(name)
+			(engine_headers if engine else headers).append(name)
 		elif name.endswith(SOURCE_TYPES):
-			sources.append(name)
+			(engine_sources if engine else sources).append(name)
 	headers.sort()
 	sources.sort()
+	engine_headers.sort()
+	engine_sources.sort()
 
-	def do_make(a_filename, a_varname, a_files):
+	def do_make(a_filename, a_lists):
 		out = open("cmake/" + a_filename + ".cmake", "w", encoding="utf-8")
-		out.write("set(" + a_varname + " ${" + a_varname + "}\n")
+		for varname, files in a_lists:
+			out.write("set(" + varname + " ${" + varname + "}\n")
 
-		for file in a_files:
-			out.write("\t" + file + "\n")
+			for file in files:
+				out.write("\t" + file + "\n")
 
-		out.write(")\n")
+			out.write(")\n")
 
-	do_make("headerlist", "headers", headers)
-	do_make("sourcelist", "sources", sources)
+	do_make("headerlist", (("headers", headers),))
+	do_make("sourcelist", (("sources", sources),))
+	do_make("enginelist", (("engine_headers", engine_headers), ("engine_sources", engine_sources)))
 
 def main():
 	cur = os.path.dirname(os.path.realpath(__file__))
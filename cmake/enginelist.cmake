@@ -0,0 +1,34 @@
+set(engine_headers ${engine_headers}
+	include/BodyGenParser.h
+	include/CacheTrace.h
+	include/CountingAllocator.h
+	include/GeometryCache.h
+	include/LatencyHistogram.h
+	include/MeshDump.h
+	include/MeshTopology.h
+	include/MorphDeltas.h
+	include/MorphIds.h
+	include/MorphMatrix.h
+	include/Morpher.h
+	include/ShardedCache.h
+	include/StringHash.h
+	include/TriArena.h
+	include/TriReader.h
+	include/VertexCodec.h
+	include/half.hpp
+	include/kd_matcher.hpp
+	include/shape.hpp
+)
+set(engine_sources ${engine_sources}
+	src/BodyGenParser.cpp
+	src/CacheTrace.cpp
+	src/GeometryCache.cpp
+	src/MeshDump.cpp
+	src/MeshTopology.cpp
+	src/MorphIds.cpp
+	src/MorphMatrix.cpp
+	src/Morpher.cpp
+	src/TriArena.cpp
+	src/TriReader.cpp
+	src/VertexCodec.cpp
+)
@@ -5,7 +5,6 @@ set(headers ${headers}
 	include/CharGenInterface.h
 	include/CharGenTint.h
 	include/GameAllocator.h
-	include/Morpher.h
 	include/OverlayInterface.h
 	include/PapyrusBodyGen.h
 	include/PapyrusOverlays.h
@@ -14,8 +13,5 @@ set(headers ${headers}
 	include/StringTable.h
 	include/TransformInterface.h
 	include/Utilities.h
-	include/half.hpp
-	include/kd_matcher.hpp
 	include/resource.h
-	include/shape.hpp
 )
@@ -4,7 +4,6 @@ set(sources ${sources}
 	src/BodyMorphInterface.cpp
 	src/CharGenInterface.cpp
 	src/CharGenTint.cpp
-	src/Morpher.cpp
 	src/OverlayInterface.cpp
 	src/PapyrusBodyGen.cpp
 	src/PapyrusOverlays.cpp
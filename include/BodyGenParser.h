@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Text side of the BodyGen ini files, kept free of game types so it can be measured on its own
+namespace BodyGen
+{
+	struct MorphRange
+	{
+		std::string	name;
+		float		lower;
+		float		upper;
+	};
+
+	typedef std::vector<MorphRange> MorphSelector;		// One of these is picked
+	typedef std::vector<MorphSelector> MorphSet;		// Every selector applies
+	typedef std::vector<MorphSet> TemplateSets;			// One of these is picked
+
+	// Same splitting the ini readers always used, empty tokens are dropped
+	std::vector<std::string> Explode(const std::string & str, char ch);
+	std::string Trim(const std::string & str);
+
+	// Splits a trimmed "left = right" line, false when either side is missing
+	bool SplitLine(const std::string & line, std::string & lSide, std::string & rSide);
+
+	// Right-hand side of a template line: sets split by '/', morphs by ',', alternatives by '|', each morph@value or morph@lower:upper
+	bool ParseTemplate(const std::string & rSide, TemplateSets & sets, std::string & error);
+
+	// Right-hand side of a morph line: template slots split by ',', alternatives by '|'
+	void ParseTemplateSlots(const std::string & rSide, std::vector<std::vector<std::string>> & slots);
+}
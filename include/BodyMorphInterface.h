@@ -15,6 +15,11 @@
 #include <ctime>
 #include <map>
 #include <functional>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include <json/json.h>
 
@@ -25,77 +30,94 @@
 
 #include "common/ICriticalSection.h"
 
+#include "TriArena.h"
+#include "MorphMatrix.h"
+#include "MorphIds.h"
+#include "ShardedCache.h"
+#include "GeometryCache.h"
+#include "CacheTrace.h"
+#include "LatencyHistogram.h"
+
 class Actor;
 class BGSKeyword;
+class BSTriShape;
 struct F4SESerializationInterface;
 class TESModel;
 
-class TriShapeVertexDelta
-{
-public:
-	UInt16		index;
-	NiPoint3	diff;
-};
-
-class TriShapePackedVertexDelta
-{
-public:
-	UInt16	index;
-	SInt16	x;
-	SInt16	y;
-	SInt16	z;
-};
-
-class TriShapeVertexData
+namespace Morpher
 {
-public:
-	virtual bool ApplyMorph(UInt16 vertCount, NiPoint3 * vertices, float factor) = 0;
-};
-typedef std::shared_ptr<TriShapeVertexData> TriShapeVertexDataPtr;
+	class MeshTopology;
+}
 
-class TriShapeFullVertexData : public TriShapeVertexData
+// Morphs of one shape, a view into the arena of its TRI file
+class BodyMorphMap
 {
 public:
-	virtual bool ApplyMorph(UInt16 vertCount, NiPoint3 * vertices, float factor) override;
+	BodyMorphMap() : m_arena(nullptr), m_shape(nullptr) { }
 
-	std::vector<TriShapeVertexDelta> m_vertexDeltas;
-};
-typedef std::shared_ptr<TriShapeFullVertexData> TriShapeFullVertexDataPtr;
+	// Morphs are weighted by slot, one per morph of the shape
+	UInt32 GetMorphCount() const { return m_shape->numMorphs; }
+	// Slot of the morph with this id, see Morpher::GetMorphId, -1 when the shape has no such morph
+	SInt32 GetMorphSlot(UInt32 morphId) const { return morphId < m_slots.size() ? m_slots[morphId] : -1; }
+	const char * GetMorphName(UInt32 slot) const { return m_arena->GetName(m_arena->GetMorphs()[m_shape->firstMorph + slot].name); }
+	// How far the morph moves any vertex at a value of 1
+	float GetMaxDisplacement(UInt32 slot) const { return m_arena->GetBounds(m_arena->GetMorphs()[m_shape->firstMorph + slot]).maxDisplacement; }
 
-class TriShapePackedVertexData : public TriShapeVertexData
-{
-public:
-	virtual bool ApplyMorph(UInt16 vertCount, NiPoint3 * vertices, float factor) override;
+	// Adds every weighted morph onto the vertices in one pass and flags every vertex they move in touched, when one is given
+	// Returns the slot of the first morph with vertices out of bounds, -1 when there were none
+	SInt32 ApplyMorphs(const float * weights, UInt32 vertCount, NiPoint3 * vertices, UInt8 * touched = nullptr) const;
 
-	float									m_multiplier;
-	std::vector<TriShapePackedVertexDelta>	m_vertexDeltas;
-};
-typedef std::shared_ptr<TriShapePackedVertexData> TriShapePackedVertexDataPtr;
-
-class BodyMorphMap : public std::unordered_map<F4EEFixedString, TriShapeVertexDataPtr>
-{
-public:
-	TriShapeVertexDataPtr GetVertexData(const F4EEFixedString & name);
+	// Welds and adjacency of the shape the morphs apply to, built on first use
+	std::shared_ptr<Morpher::MeshTopology> GetTopology();
+	// Only replaces the topology if nobody else did since it was read, returns false otherwise
+	bool ReplaceTopology(const std::shared_ptr<Morpher::MeshTopology> & expected, const std::shared_ptr<Morpher::MeshTopology> & topology);
 
 protected:
-	SimpleLock	m_morphLock;
+	friend class TriShapeMap;
+
+	const Morpher::TriArena *				m_arena;
+	const Morpher::TriArena::Shape *		m_shape;
+	Morpher::MorphMatrix					m_matrix;	// Built with the shapes, read only afterwards
+	std::vector<SInt32>						m_slots;	// By morph id, up to the highest one the shape has
+	SimpleLock								m_morphLock;
+	std::shared_ptr<Morpher::MeshTopology>	m_topology;
 };
 typedef std::shared_ptr<BodyMorphMap> BodyMorphMapPtr;
 
-// Maps Shape name to Morphs
-class TriShapeMap : public std::unordered_map<F4EEFixedString, BodyMorphMapPtr>
+// Maps Shape name to Morphs, everything the TRI file held lives in one arena
+class TriShapeMap : public std::enable_shared_from_this<TriShapeMap>
 {
 public:
-	TriShapeMap()
-	{
-		memoryUsage = sizeof(TriShapeMap);
-		accessed = 0;
-	}
+	// Maps are only created here, so their object and control block always take GetObjectSize bytes
+	static std::shared_ptr<TriShapeMap> Create();
+
+	// Parses the file, nothing else may use the map before this succeeded
+	// Full precision morphs are quantized first when maxError is not negative and the error stays within it
+	bool Load(const UInt8 * data, size_t size, float maxError = -1.0f);
+	// Uses a saved arena in place instead, owner keeps its memory alive
+	bool LoadCached(const UInt8 * data, size_t size, const Morpher::TriArena::SourceKey & key, const std::shared_ptr<const void> & owner);
+	// The matrices hold the only deltas that are used, so the arena's copy goes once it is saved
+	// Releases the owner of a cached arena too, before the map is shared
+	void ReleaseDeltas();
+
+	// Shares ownership with this map, so the morphs stay valid while it is held
 	BodyMorphMapPtr GetMorphData(const F4EEFixedString & name);
 
-	SimpleLock	m_morphLock;
-	UInt32 memoryUsage;
-	std::time_t accessed;
+	UInt32 GetShapeCount() const { return m_arena.GetShapeCount(); }
+	const char * GetShapeName(UInt32 index) const { return m_arena.GetName(m_arena.GetShapes()[index].name); }
+
+	const Morpher::TriArena & GetArena() const { return m_arena; }
+
+	// Everything the map holds on the heap: the object, its arena block, the shape views with their matrices and the topologies built so far
+	// Maps are only shared after ReleaseDeltas, so the deltas are counted once, in the matrices
+	size_t GetMemoryUsage();
+
+protected:
+	void BuildShapes(float maxError);
+	static size_t GetObjectSize();
+
+	Morpher::TriArena					m_arena;
+	std::vector<BodyMorphMap>			m_shapes;
 };
 typedef std::shared_ptr<TriShapeMap> TriShapeMapPtr;
 
@@ -104,6 +126,11 @@ typedef std::shared_ptr<TriShapeMap> TriShapeMapPtr;
 class UserValues : public std::unordered_map<UInt32, float>
 {
 public:
+	explicit UserValues(UInt32 morphId) : m_morphId(morphId) { }
+
+	// Id of the morph these are for, so shapes find its slot without the name
+	UInt32 GetMorphId() const { return m_morphId; }
+
 	float GetValue(BGSKeyword * keyword);
 	void SetValue(BGSKeyword * keyword, float value);
 
@@ -115,6 +142,9 @@ public:
 	{
 		clear();
 	}
+
+protected:
+	UInt32	m_morphId;
 };
 typedef std::shared_ptr<UserValues> UserValuesPtr;
 
@@ -198,10 +228,34 @@ protected:
 	BSModelDB::BSModelProcessor	* m_oldProcessor;
 };
 
+struct MorphCacheStats
+{
+	UInt64	count;
+	UInt64	resident;		// Everything held, the files and the cache's own bookkeeping
+	UInt64	overhead;
+	UInt64	limit;
+	UInt64	hits;
+	UInt64	misses;
+	UInt64	loads;
+	UInt64	failures;
+	UInt64	evictions;
+	UInt64	expirations;	// Evicted for being idle too long
+	UInt64	bytesLoaded;	// Resident size of every file when it was loaded, evicted ones included
+	double	loadTime[3];	// 50th, 90th and 99th percentile in milliseconds
+	std::vector<std::pair<std::string, UInt64>>	largest;
+
+	// Morphed vertex blocks shared between actors
+	UInt64	geometryCount;
+	UInt64	geometryResident;
+	UInt64	geometryLimit;
+	UInt64	geometryHits;
+	UInt64	geometryMisses;
+};
+
 class BodyMorphInterface
 {
 public:
-	BodyMorphInterface() : m_totalMemory(0), m_memoryLimit(0x80000000LL) { } // 2GB
+	BodyMorphInterface() : m_morphCache(0x80000000LL), m_geometryCache(0x10000000LL), m_loads(0), m_loadFailures(0), m_bytesLoaded(0), m_lastStatsLog(0), m_statsInterval(0), m_lastFailureRetry(0), m_loaderThreads(0), m_maintenanceRunning(false), m_maintenanceWake(false), m_lowWater(1.0f), m_idleMinutes(0) { } // 2GB of TRI files, 256MB of morphed geometry
 	
 	enum
 	{
@@ -222,6 +276,12 @@ public:
 	virtual void ForEachSlider(UInt8 gender, std::function<void(const BodySliderPtr & slider)> func);
 
 	virtual TriShapeMapPtr GetTrishapeMap(const char * relativePath);
+
+	// Queues the file for a loader thread and returns at once, the map is only returned when it is already loaded
+	// loading is set when it is not but will be, rather than having failed before
+	// Without loader threads this is the same as GetTrishapeMap
+	TriShapeMapPtr PrefetchTrishapeMap(const char * relativePath, bool * loading = nullptr);
+	void StartLoaders(UInt32 count);
 	virtual MorphValueMapPtr GetMorphMap(Actor * actor, bool isFemale);
 
 	virtual void SetMorph(Actor * actor, bool isFemale, const BSFixedString & morph, BGSKeyword * keyword, float value);
@@ -242,19 +302,72 @@ public:
 	virtual bool UpdateMorphs(Actor * actor);
 
 	bool IsNodeMorphable(NiAVObject * rootNode);
+	// The TRI file and shape name the model processor tagged a shape with, false when it has none or is not in the file
+	bool GetMorphTags(BSTriShape * trishape, F4EEFixedString & morphPath, F4EEFixedString & shapeName);
 
+	// Evicts once a cache is over its limit, inline unless the maintenance thread does it
 	void ShrinkMorphCache();
+	// Evicts in the background instead, down to lowWater of the limit so it is not woken again right away
+	// Entries nobody used for idleMinutes are dropped as well, 0 keeps them until the limit is reached
+	void StartMaintenance(float lowWater, UInt32 idleMinutes);
 	void SetCacheLimit(UInt64 limit);
+	void SetCachePolicy(Morpher::CachePolicy policy);
+	// Bytes of morphed vertex blocks kept for other actors with the same morphs, 0 morphs every shape on its own
+	void SetGeometryCacheLimit(UInt64 limit);
+	// Bytes held by the cached TRI files and by the cache itself, what the limit is compared against
+	UInt64 GetCacheMemoryUsage() const { return m_morphCache.GetResident(); }
+	void GetCacheStats(MorphCacheStats & stats, UInt32 largest = 5);
+	// One "name: value" line per counter, then the largest files
+	void FormatCacheStats(std::vector<std::string> & lines, UInt32 largest = 5);
+	void LogCacheStats();
+	// Logs the stats every interval seconds while models are loaded, 0 turns it off
+	void SetCacheStatsInterval(UInt32 seconds) { m_statsInterval = seconds; }
+	// Records every TRI lookup for f4ee_cachesim
+	bool StartCacheTrace(const char * path);
+	// Kept loaded no matter the limit, e.g. whatever the player wears, until unpinned again
+	void PinTrishapeMap(const F4EEFixedString & filePath, bool pin = true);
+	// Pins the TRI files of everything the player wears, slotNode included, and unpins the ones of what they took off
+	void UpdatePlayerPins(Actor * actor, NiAVObject * slotNode);
 	void SetModelProcessor();
 
 private:
+	TriShapeMapPtr LoadTrishapeMap(const F4EEFixedString & filePath);
+	TriShapeMapPtr FinishTrishapeMap(const F4EEFixedString & filePath);
+	void RunLoader();
+	void RunMaintenance();
+	void LogCacheStatsIfDue();
+	void RetryFailedLoadsIfDue();
+
 	SimpleLock											m_morphLock;
 	std::unordered_map<UInt32, MorphValueMapPtr>		m_morphMap[2];
 
-	SimpleLock											m_morphCacheLock;
-	std::unordered_map<F4EEFixedString, TriShapeMapPtr>	m_morphCache;
-	UInt64												m_totalMemory;
-	UInt64												m_memoryLimit;
+	// Parsed TRI files by path, files that failed to load are kept as empty maps so they are only retried now and then
+	Morpher::ShardedCache<F4EEFixedString, TriShapeMapPtr>	m_morphCache;
+	// Morphed vertex blocks, filled by the first actor to morph a shape a certain way and copied by everyone after
+	Morpher::GeometryCache									m_geometryCache;
+	Morpher::CacheTraceWriter								m_morphTrace;
+	Morpher::LatencyHistogram								m_loadTimes;	// Microseconds
+	std::atomic<UInt64>										m_loads;
+	std::atomic<UInt64>										m_loadFailures;
+	std::atomic<UInt64>										m_bytesLoaded;
+	std::atomic<UInt64>										m_lastStatsLog;
+	UInt32													m_statsInterval;
+	std::atomic<UInt64>										m_lastFailureRetry;
+
+	std::mutex											m_loadQueueLock;
+	std::condition_variable								m_loadQueueSignal;
+	std::deque<F4EEFixedString>							m_loadQueue;
+	UInt32												m_loaderThreads;
+
+	std::mutex											m_pinLock;
+	std::unordered_set<F4EEFixedString>					m_playerPins;	// What UpdatePlayerPins pinned last
+
+	std::mutex											m_maintenanceLock;
+	std::condition_variable								m_maintenanceSignal;
+	std::atomic<bool>									m_maintenanceRunning;
+	std::atomic<bool>									m_maintenanceWake;	// Set by the hot paths, cleared by the thread before each pass
+	float												m_lowWater;
+	UInt32												m_idleMinutes;
 
 	std::unordered_map<F4EEFixedString, BodySliderPtr>	m_sliderMap[2];
 };
\ No newline at end of file
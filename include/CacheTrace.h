@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ShardedCache.h"
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Morpher
+{
+	// Morph cache accesses recorded while playing, replayed offline to pick a cache limit and policy
+	// One event per line: "A <size> <path>" for an access of a file taking size bytes once loaded, "P <path>" and "U <path>" for pinning
+	struct CacheTraceEvent
+	{
+		enum Type
+		{
+			kAccess,
+			kPin,
+			kUnpin
+		};
+
+		Type		type;
+		uint64_t	size;
+		std::string	key;
+	};
+
+	class CacheTraceWriter
+	{
+	public:
+		CacheTraceWriter() : m_file(nullptr) { }
+		~CacheTraceWriter() { Close(); }
+
+		// Appends to the file, so several sessions can be replayed as one
+		bool Open(const char * path);
+		void Close();
+		bool IsOpen() const { return m_file != nullptr; }
+
+		void Access(const char * key, uint64_t size);
+		void Pin(const char * key, bool pin);
+
+	protected:
+		std::mutex	m_lock;
+		FILE *		m_file;
+	};
+
+	// Malformed lines are skipped, false only when the file could not be read
+	bool ReadCacheTrace(const char * path, std::vector<CacheTraceEvent> & events);
+
+	struct CacheReplayResult
+	{
+		CacheReplayResult() : accesses(0), hits(0), misses(0), evictions(0), bytesLoaded(0), peakSize(0) { }
+
+		uint64_t	accesses;
+		uint64_t	hits;
+		uint64_t	misses;
+		uint64_t	evictions;
+		uint64_t	bytesLoaded;
+		uint64_t	peakSize;
+	};
+
+	// Runs the events through a cache like the plugin's, shrinking after every access
+	// Once over the limit it is shrunk to lowWater of it, like the maintenance thread does, 1 shrinks to the limit itself
+	void ReplayCacheTrace(const std::vector<CacheTraceEvent> & events, CachePolicy policy, uint64_t limit, CacheReplayResult & result, float lowWater = 1.0f);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Standard allocator that adds every allocation to a counter, for containers and shared objects whose real size is otherwise unknown
+	// Node containers and allocate_shared rebind it, so their nodes, buckets and control blocks are all counted
+	// Without a counter nothing is counted, for objects that only need the same control block type as counted ones
+	template<typename T>
+	class CountingAllocator
+	{
+	public:
+		typedef T value_type;
+
+		explicit CountingAllocator(std::atomic<int64_t> * counter) : m_counter(counter) { }
+
+		template<typename U>
+		CountingAllocator(const CountingAllocator<U> & other) : m_counter(other.GetCounter()) { }
+
+		T * allocate(size_t count)
+		{
+			T * memory = std::allocator<T>().allocate(count);
+			if(m_counter)
+				*m_counter += (int64_t)(count * sizeof(T));
+			return memory;
+		}
+
+		void deallocate(T * memory, size_t count)
+		{
+			if(m_counter)
+				*m_counter -= (int64_t)(count * sizeof(T));
+			std::allocator<T>().deallocate(memory, count);
+		}
+
+		std::atomic<int64_t> * GetCounter() const { return m_counter; }
+
+		template<typename U>
+		bool operator==(const CountingAllocator<U> & other) const { return m_counter == other.GetCounter(); }
+		template<typename U>
+		bool operator!=(const CountingAllocator<U> & other) const { return m_counter != other.GetCounter(); }
+
+	protected:
+		std::atomic<int64_t> *	m_counter;
+	};
+}
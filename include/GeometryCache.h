@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ShardedCache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Everything a morphed vertex block depends on, actors wearing the same mesh with the same morph values end up with equal keys
+	struct GeometryKey
+	{
+		GeometryKey() : vertexDesc(0), numVertices(0), baseHash(0), hash(0) { }
+		GeometryKey(const char * morphPath, const char * shapeName, uint64_t vertexDesc, uint32_t numVertices, uint64_t baseHash, const float * weights, uint32_t numWeights);
+
+		bool operator==(const GeometryKey & other) const;
+
+		// What the key itself keeps alive, charged to the cache along with the block
+		uint64_t GetMemoryUsage() const;
+
+		std::string			morphPath;		// Compared ignoring case, like the TRI paths
+		std::string			shapeName;
+		uint64_t			vertexDesc;
+		uint32_t			numVertices;
+		uint64_t			baseHash;		// Content of the vertex block the morphs are applied to
+		std::vector<float>	weights;		// One per morph of the shape, compared exactly
+		size_t				hash;
+	};
+
+	struct GeometryKeyHash
+	{
+		size_t operator()(const GeometryKey & key) const { return key.hash; }
+	};
+
+	// Morphed vertex blocks by what went into them, every shape copies from the same block
+	typedef std::shared_ptr<const std::vector<uint8_t>> GeometryBlockPtr;
+	typedef ShardedCache<GeometryKey, GeometryBlockPtr, GeometryKeyHash> GeometryCache;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Morpher
+{
+	// Lock free histogram of durations, buckets are a quarter octave wide so a percentile is off by at most 25%
+	class LatencyHistogram
+	{
+	public:
+		enum
+		{
+			kSubBuckets = 4,
+			kBuckets = 64 * kSubBuckets
+		};
+
+		LatencyHistogram() { Clear(); }
+
+		void Record(uint64_t value)
+		{
+			m_buckets[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void Clear()
+		{
+			for(auto & bucket : m_buckets)
+				bucket.store(0, std::memory_order_relaxed);
+		}
+
+		uint64_t GetCount() const
+		{
+			uint64_t count = 0;
+			for(auto & bucket : m_buckets)
+				count += bucket.load(std::memory_order_relaxed);
+			return count;
+		}
+
+		// Upper bound of the bucket holding the given fraction of the samples, 0 without samples
+		uint64_t GetPercentile(double fraction) const
+		{
+			uint64_t count = GetCount();
+			if(!count)
+				return 0;
+
+			uint64_t rank = (uint64_t)(fraction * count);
+			if(rank >= count)
+				rank = count - 1;
+
+			uint64_t seen = 0;
+			for(uint32_t i = 0; i < kBuckets; i++)
+			{
+				seen += m_buckets[i].load(std::memory_order_relaxed);
+				if(seen > rank)
+					return GetUpperBound(i);
+			}
+			return GetUpperBound(kBuckets - 1);
+		}
+
+	protected:
+		// Values below 4 get a bucket each, above that every octave is split in four by the two bits under the top one
+		static uint32_t GetBucket(uint64_t value)
+		{
+			if(value < kSubBuckets)
+				return (uint32_t)value;
+
+			uint32_t octave = 63;
+			while(!(value >> octave))
+				octave--;
+			return kSubBuckets + (octave - 2) * kSubBuckets + (uint32_t)((value >> (octave - 2)) & (kSubBuckets - 1));
+		}
+
+		static uint64_t GetUpperBound(uint32_t bucket)
+		{
+			if(bucket < kSubBuckets)
+				return bucket;
+
+			uint32_t octave = (bucket - kSubBuckets) / kSubBuckets + 2;
+			uint64_t sub = (bucket - kSubBuckets) % kSubBuckets;
+			return ((kSubBuckets + sub + 1) << (octave - 2)) - 1;
+		}
+
+		std::atomic<uint64_t>	m_buckets[kBuckets];
+	};
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Morpher.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Owned copy of a shape's geometry, so a mesh seen in game can be morphed again outside of it
+	class MeshDump
+	{
+	public:
+		MeshDump() : numVertices(0) { }
+
+		void Assign(const GeometryView & view);
+
+		// Points into this dump, stays valid until it is modified
+		GeometryView GetView();
+
+		// Little endian: magic, version, layout, counts, then the vertex block and the triangles as they are in memory
+		void Serialize(std::vector<uint8_t> & out) const;
+		bool Deserialize(const uint8_t * data, size_t size);
+
+		VertexLayout			layout;
+		uint32_t				numVertices;
+		std::vector<uint8_t>	vertexBlock;
+		std::vector<Triangle>	triangles;
+	};
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace Morpher
+{
+	// Sets of coincident vertices, e.g. the copies a UV seam splits a position into
+	// Two vertices are welded when they are closer than the epsilon on every axis, welds are transitive
+	class WeldGroups
+	{
+	public:
+		void Build(const Vector3 * points, uint32_t numPoints, double epsilon = EPSILON);
+		void Clear();
+
+		// Only groups with at least two members are kept
+		uint32_t GetGroupCount() const { return m_offsets.empty() ? 0 : (uint32_t)m_offsets.size() - 1; }
+		bool IsEmpty() const { return GetGroupCount() == 0; }
+
+		const uint32_t * GroupBegin(uint32_t group) const { return &m_members[m_offsets[group]]; }
+		const uint32_t * GroupEnd(uint32_t group) const { return &m_members[0] + m_offsets[group + 1]; }
+
+		size_t GetMemoryUsage() const;
+
+	protected:
+		std::vector<uint32_t> m_offsets;
+		std::vector<uint32_t> m_members;
+	};
+
+	// Everything the normal and tangent recalculation needs that only depends on the base mesh
+	class MeshTopology
+	{
+	public:
+		MeshTopology() : m_numVertices(0), m_numTriangles(0), m_triangleHash(0) { }
+
+		// Weld positions have to be in the space the normals are smoothed in
+		void Build(const Vector3 * weldPositions, uint32_t numVertices, const Triangle * triangles, uint32_t numTriangles);
+
+		// True when this was built for the same vertex count and triangle list
+		bool Matches(uint32_t numVertices, const Triangle * triangles, uint32_t numTriangles) const;
+
+		uint32_t GetVertexCount() const { return m_numVertices; }
+		uint32_t GetTriangleCount() const { return m_numTriangles; }
+
+		// Triangles using the vertex in ascending order, a degenerate triangle is listed once per corner it occupies
+		const uint32_t * TrianglesBegin(uint32_t vertex) const { return m_vertexTriangles.data() + m_vertexOffsets[vertex]; }
+		const uint32_t * TrianglesEnd(uint32_t vertex) const { return m_vertexTriangles.data() + m_vertexOffsets[vertex + 1]; }
+
+		const WeldGroups & GetWelds() const { return m_welds; }
+
+		size_t GetMemoryUsage() const;
+
+		static uint64_t HashTriangles(const Triangle * triangles, uint32_t numTriangles);
+
+	protected:
+		uint32_t				m_numVertices;
+		uint32_t				m_numTriangles;
+		uint64_t				m_triangleHash;
+		WeldGroups				m_welds;
+		std::vector<uint32_t>	m_vertexOffsets;
+		std::vector<uint32_t>	m_vertexTriangles;
+	};
+	typedef std::shared_ptr<MeshTopology> MeshTopologyPtr;
+
+	// Blends the normals of welded vertices, each member only takes in normals within the angle threshold of its own
+	// With a mask only groups whose members are flagged are touched, groups are expected to be flagged as a whole
+	void SmoothWeldedNormals(const WeldGroups & groups, Vector3 * normals, float smoothThresh, const uint8_t * mask = nullptr);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Morpher
+{
+	// Full precision delta as stored in 'TRI\0' files, the index is stored as 32 bits but only 16 are used
+	struct TriVertexDelta
+	{
+		uint16_t	index;
+		float		x;
+		float		y;
+		float		z;
+	};
+
+	// Quantized delta as stored in 'TRIP' files, scaled by the morph's multiplier
+	struct TriPackedVertexDelta
+	{
+		uint16_t	index;
+		int16_t		x;
+		int16_t		y;
+		int16_t		z;
+	};
+}
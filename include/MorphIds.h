@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Dense ids for morph names, shared by the TRI files and the values set on actors
+	// A name gets the same id every time, ignoring case, ids are never freed and stay below GetMorphIdCount
+	uint32_t GetMorphId(const char * name, size_t length);
+	uint32_t GetMorphIdCount();
+}
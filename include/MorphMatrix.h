@@ -0,0 +1,86 @@
+#pragma once
+
+#include "shape.hpp"
+#include "TriArena.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Morphs whose deltas cover at least this share of the vertices between their first and last one are stored dense
+	// Anything above 1 keeps every morph sparse
+	void SetDenseMorphDensity(float density);
+	float GetDenseMorphDensity();
+
+	// Every morph of one shape as a vertex major matrix, rows are vertices and columns the shape's morphs
+	// Sparse morphs are rows of index and delta, dense ones a contiguous delta per vertex over their span
+	// Deltas of packed arenas stay 16 bit with a multiplier per column, full precision ones are floats
+	// Applying a set of morph values is one pass over the rows, each vertex is read and written once per range
+	class MorphMatrix
+	{
+	public:
+		MorphMatrix() : m_packed(false), m_numColumns(0) { }
+
+		// Columns are the shape's morphs in arena order, see TriArena::Shape::firstMorph
+		// A delta of zero moves nothing and is dropped, so it does not flag its vertex either
+		void Build(const TriArena & arena, const TriArena::Shape & shape);
+		void Clear();
+
+		uint32_t GetRowCount() const { return m_offsets.empty() ? 0 : (uint32_t)m_offsets.size() - 1; }
+		uint32_t GetColumnCount() const { return m_numColumns; }
+		uint32_t GetEntryCount() const { return m_offsets.empty() ? 0 : m_offsets.back(); }
+		uint32_t GetDenseColumnCount() const { return (uint32_t)m_denseColumns.size(); }
+		bool IsPacked() const { return m_packed; }
+
+		// Adds the weighted deltas onto the vertices and flags every vertex a weighted column moves in touched, when one is given
+		// weights holds one value per column, rows are split across threads by range once there are enough of them
+		// Rows past the vertex count are skipped, the first column with a weight in them is returned so the caller can report it, -1 otherwise
+		int32_t Apply(const float * weights, Vector3 * vertices, uint32_t numVertices, uint8_t * touched) const;
+
+		size_t GetMemoryUsage() const;
+
+	protected:
+		struct DenseColumn
+		{
+			uint32_t	column;
+			uint32_t	first;		// Row of the first delta
+			uint32_t	count;		// Rows up to and including the last delta
+			size_t		offset;		// Into the dense deltas, three per row
+			bool		gaps;		// Some rows of the span have no delta
+		};
+
+		struct WeightedColumn
+		{
+			const DenseColumn *	dense;
+			float				weight;
+		};
+
+		// Packed with the column in the fourth lane, so an entry loads as one 64 bit word
+		struct PackedEntry
+		{
+			int16_t		x;
+			int16_t		y;
+			int16_t		z;
+			uint16_t	column;
+		};
+
+		void ApplyRows(const float * weights, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const;
+		void ApplyPackedRows(const float * weights, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const;
+		void ApplyDense(const WeightedColumn & weighted, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const;
+		void ApplyPackedDense(const WeightedColumn & weighted, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const;
+
+		bool						m_packed;
+		uint32_t					m_numColumns;
+		std::vector<uint32_t>		m_columnEnds;	// One past the last row of every column, 0 when it has no deltas
+		std::vector<uint32_t>		m_offsets;		// First sparse entry of every row, one more than there are rows
+		std::vector<uint32_t>		m_columns;		// Full precision only, like the float deltas
+		std::vector<float>			m_deltas;		// Three per entry and one spare, so every entry can be loaded as four floats
+		std::vector<DenseColumn>	m_denseColumns;
+		std::vector<float>			m_dense;
+		std::vector<float>			m_multipliers;	// Packed only, one per column
+		std::vector<PackedEntry>	m_packedEntries;
+		std::vector<int16_t>		m_packedDense;
+	};
+}
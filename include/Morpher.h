@@ -1,27 +1,109 @@
 #pragma once
 
 #include "shape.hpp"
-#include "kd_matcher.hpp"
+#include "MeshTopology.h"
+#include "VertexCodec.h"
 
 #include <vector>
 #include <functional>
+#include <cstdint>
 
 class BSTriShape;
 
+namespace Morpher
+{
+	// Plain description of the geometry a morph is applied to, in game it is filled from a BSTriShape
+	struct GeometryView
+	{
+		GeometryView() : vertexBlock(nullptr), numVertices(0), triangles(nullptr), numTriangles(0) { }
+
+		VertexLayout	layout;
+		uint8_t *		vertexBlock;
+		uint32_t		numVertices;
+		Triangle *		triangles;
+		uint32_t		numTriangles;
+	};
+
+	// Region work lists at least this long are split across threads, 0 disables threading
+	void SetParallelVertexThreshold(uint32_t threshold);
+	uint32_t GetParallelVertexThreshold();
+
+	// Splits [0, count) into chunks run across threads once count reaches the threshold, func gets [begin, end)
+	void ForEachRange(uint32_t count, const std::function<void(uint32_t, uint32_t)> & func);
+}
+
+// Buffers one morph application works in, owned per thread and reused so steady state morphing does not allocate
+struct MorphScratch
+{
+	std::vector<Morpher::Vector3> vertices;
+	std::vector<Morpher::Vector3> normals;
+	std::vector<Morpher::Vector2> uvs;
+	std::vector<Morpher::Vector3> tangents;
+	std::vector<Morpher::Vector3> bitangents;
+
+	std::vector<uint8_t> touched;
+	std::vector<uint8_t> regionMask;
+	std::vector<uint8_t> triangleMask;
+	std::vector<uint32_t> regionVertices;
+	std::vector<uint32_t> regionTriangles;
+
+	std::vector<Morpher::Vector3> normalSpace;
+	std::vector<Morpher::Vector3> vertexNormals;
+	std::vector<Morpher::Vector3> triangleNormals;
+	std::vector<Morpher::Vector3> triangleTangents;
+	std::vector<Morpher::Vector3> triangleBitangents;
+};
+
+// Decodes a shape's vertex block, lets the caller move the positions and writes them back with a fresh tangent frame
+// Staged use: construct, morph GetVertices() while flagging GetTouched(), then Apply()
 class MorphApplicator
 {
 public:
-	MorphApplicator(BSTriShape * _geometry, UInt8 * srcBlock, UInt8 * dstBlock, std::function<void(std::vector<Morpher::Vector3> &)> morph);
+	// Reads the geometry's vertex block and writes into dstBlock, or back into the geometry's block when it is null
+	MorphApplicator(const Morpher::GeometryView & _geometry, uint8_t * dstBlock, Morpher::MeshTopologyPtr & _topology);
+	MorphApplicator(const Morpher::GeometryView & _geometry, uint8_t * dstBlock, Morpher::MeshTopologyPtr & _topology, std::function<void(std::vector<Morpher::Vector3> &, std::vector<uint8_t> &)> morph);
+	// The original interface over a game shape, reads srcBlock or the shape's block and writes dstBlock or the shape's block
+	// Defined with the plugin, the topology is built on every call and the moved vertices are found by comparing positions
+	MorphApplicator(BSTriShape * _geometry, uint8_t * srcBlock, uint8_t * dstBlock, std::function<void(std::vector<Morpher::Vector3> &)> morph);
+	~MorphApplicator();
+
+	// Runs the whole pipeline with any callable, the call is resolved statically and can be inlined
+	template<typename F>
+	MorphApplicator(const Morpher::GeometryView & _geometry, uint8_t * dstBlock, Morpher::MeshTopologyPtr & _topology, F && morph) : MorphApplicator(_geometry, dstBlock, _topology)
+	{
+		morph(rawVertices, touched);
+		Apply();
+	}
+
+	std::vector<Morpher::Vector3> & GetVertices() { return rawVertices; }
+	std::vector<uint8_t> & GetTouched() { return touched; }
 
-	void RecalcNormals(UInt32 numTriangles, Morpher::Triangle* triangles, const bool smooth = true, const float smoothThres = 60.0f);
-	void CalcTangentSpace(UInt32 numTriangles, Morpher::Triangle * triangles);
+	// Recalculates the frame around the touched vertices and encodes into the destination block
+	void Apply();
+
+	void RecalcNormals(uint32_t numTriangles, Morpher::Triangle* triangles, const bool smooth = true, const float smoothThres = 60.0f);
+	void CalcTangentSpace(uint32_t numTriangles, Morpher::Triangle * triangles);
 
 protected:
-	BSTriShape * geometry;
-	std::function<void(std::vector<Morpher::Vector3> &)> morphFunc;
-	std::vector<Morpher::Vector3> rawVertices;
-	std::vector<Morpher::Vector3> rawNormals;
-	std::vector<Morpher::Vector2> rawUV;
-	std::vector<Morpher::Vector3> rawTangents;
-	std::vector<Morpher::Vector3> rawBitangents;
+	// Collects the vertices whose frame has to be recalculated from the ones the morphs moved
+	void BuildRegion(const std::vector<uint8_t> & touched, Morpher::Triangle * triangles);
+
+	Morpher::VertexLayout layout;
+	uint8_t * sourceBlock;
+	uint8_t * targetBlock;
+	Morpher::Triangle * triangles;
+	uint32_t numTriangles;
+	bool recalcFrame;
+
+	Morpher::MeshTopologyPtr topology;
+	MorphScratch * scratch;
+	std::vector<uint8_t> & touched;
+	std::vector<uint8_t> & regionMask;
+	std::vector<uint32_t> & regionVertices;
+	std::vector<uint32_t> & regionTriangles;
+	std::vector<Morpher::Vector3> & rawVertices;
+	std::vector<Morpher::Vector3> & rawNormals;
+	std::vector<Morpher::Vector2> & rawUV;
+	std::vector<Morpher::Vector3> & rawTangents;
+	std::vector<Morpher::Vector3> & rawBitangents;
 };
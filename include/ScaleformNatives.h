@@ -63,6 +63,12 @@ public:
 	virtual void	Invoke(Args * args);
 };
 
+class F4EEScaleform_GetMorphCacheStats : public GFxFunctionHandler
+{
+public:
+	virtual void	Invoke(Args * args);
+};
+
 class F4EEScaleform_GetOverlays : public GFxFunctionHandler
 {
 public:
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <set>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "StringHash.h"
+#include "CountingAllocator.h"
+
+namespace Morpher
+{
+	enum CachePolicy
+	{
+		kCachePolicyLRU,				// Least recently used goes first
+		kCachePolicyLFU,				// Least often used goes first, ties by age
+		kCachePolicyGreedyDualSize,		// Largest and least recently used go first, keeps many small files over a few big ones
+		kCachePolicyCount
+	};
+
+	inline const char * GetCachePolicyName(CachePolicy policy)
+	{
+		static const char * names[kCachePolicyCount] = { "lru", "lfu", "gds" };
+		return policy < kCachePolicyCount ? names[policy] : "";
+	}
+
+	inline bool ParseCachePolicy(const char * name, CachePolicy & policy)
+	{
+		for(uint32_t i = 0; i < kCachePolicyCount; i++)
+		{
+			const char * policyName = GetCachePolicyName((CachePolicy)i);
+			if(EqualLower(name, policyName, strlen(policyName))) {
+				policy = (CachePolicy)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Size bounded cache split into shards with a lock each
+	// Under LRU every shard keeps its entries on an intrusive list, the other policies keep them ordered by priority
+	// Eviction takes the lowest entry over all shards, so it behaves like one cache without a global lock
+	// A key is only loaded once, everyone asking for it while that load is in flight waits on the same future
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+	class ShardedCache
+	{
+	public:
+		enum Status
+		{
+			kFound,		// Value is set
+			kPending,	// Someone else is loading it, pending is set
+			kLoad		// The caller has to load it and pass the result to Complete
+		};
+
+		explicit ShardedCache(uint64_t limit, CachePolicy policy = kCachePolicyLRU, uint32_t shardCount = 16)
+			: m_overhead(0), m_policy(policy), m_limit(limit), m_size(0), m_count(0), m_clock(0), m_inflation(0.0), m_hits(0), m_misses(0), m_evictions(0), m_expirations(0)
+		{
+			m_shardMask = 1;
+			while(m_shardMask < shardCount)
+				m_shardMask <<= 1;
+			for(uint32_t i = 0; i < m_shardMask; i++)
+				m_shards.emplace_back(new Shard(&m_overhead));
+			m_shardMask--;
+		}
+
+		// Looks the key up and marks it as used, a miss registers the caller as its loader
+		// A kLoad caller has to call Complete or Fail on every path, or everyone asking for the key waits forever
+		Status Acquire(const Key & key, Value & value, std::shared_future<Value> & pending)
+		{
+			Shard & shard = GetShard(key);
+			std::lock_guard<std::mutex> locker(shard.lock);
+			auto it = shard.entries.find(key);
+			if(it != shard.entries.end()) {
+				Touch(shard, it->second);
+				value = it->second.value;
+				m_hits++;
+				return kFound;
+			}
+
+			auto load = shard.loads.find(key);
+			if(load != shard.loads.end()) {
+				pending = load->second.future;
+				m_hits++;
+				return kPending;
+			}
+
+			Load & newLoad = shard.loads[key];
+			newLoad.future = newLoad.promise.get_future().share();
+			m_misses++;
+			return kLoad;
+		}
+
+		// Stores what a kLoad caller loaded and wakes everyone waiting for it, failures can be kept as empty values
+		void Complete(const Key & key, const Value & value, uint64_t size)
+		{
+			Shard & shard = GetShard(key);
+			std::promise<Value> promise;
+			{
+				std::lock_guard<std::mutex> locker(shard.lock);
+				auto result = shard.entries.emplace(key, Entry());
+				if(result.second) {
+					Entry & entry = result.first->second;
+					entry.key = &result.first->first;
+					entry.value = value;
+					entry.size = size;
+					entry.pinned = shard.pinned.find(key) != shard.pinned.end();
+					Rank(entry, true);
+					Link(shard, entry);
+					m_size += size;
+					m_count++;
+				}
+
+				auto load = shard.loads.find(key);
+				if(load != shard.loads.end()) {
+					promise = std::move(load->second.promise);
+					shard.loads.erase(load);
+				}
+			}
+			promise.set_value(value);
+		}
+
+		// Ends a load that could not finish, e.g. it threw, without caching anything
+		// Everyone waiting gets an empty value and the next Acquire loads the key again
+		void Fail(const Key & key)
+		{
+			Shard & shard = GetShard(key);
+			std::promise<Value> promise;
+			{
+				std::lock_guard<std::mutex> locker(shard.lock);
+				auto load = shard.loads.find(key);
+				if(load != shard.loads.end()) {
+					promise = std::move(load->second.promise);
+					shard.loads.erase(load);
+				}
+			}
+			promise.set_value(Value());
+		}
+
+		// Returns the cached value, or waits for the load in flight, or loads it with load(size)
+		template<typename F>
+		Value GetOrLoad(const Key & key, F && load)
+		{
+			Value value;
+			std::shared_future<Value> pending;
+			switch(Acquire(key, value, pending))
+			{
+			case kFound:
+				return value;
+			case kPending:
+				return pending.get();
+			default:
+				break;
+			}
+
+			// A throwing load releases the waiters before it is rethrown, and is tried again by whoever asks next
+			uint64_t size = 0;
+			try
+			{
+				value = load(size);
+			}
+			catch(...)
+			{
+				Fail(key);
+				throw;
+			}
+			Complete(key, value, size);
+			return value;
+		}
+
+		// Only looks, does not count as a use
+		bool Contains(const Key & key)
+		{
+			Shard & shard = GetShard(key);
+			std::lock_guard<std::mutex> locker(shard.lock);
+			return shard.entries.find(key) != shard.entries.end();
+		}
+
+		// Changes the size charged for an entry, only while it still holds expected
+		// Not a use, under GreedyDual-Size only the size part of the priority changes and the inflation it was ranked with stays
+		bool Resize(const Key & key, const Value & expected, int64_t delta)
+		{
+			Shard & shard = GetShard(key);
+			std::lock_guard<std::mutex> locker(shard.lock);
+			auto it = shard.entries.find(key);
+			if(it == shard.entries.end() || !(it->second.value == expected))
+				return false;
+
+			Entry & entry = it->second;
+			if(m_policy == kCachePolicyGreedyDualSize) {
+				Unlink(shard, entry);
+				entry.priority -= GetSizeCredit(entry.size);
+				entry.size += (uint64_t)delta;
+				entry.priority += GetSizeCredit(entry.size);
+				Link(shard, entry);
+			}
+			else
+				entry.size += (uint64_t)delta;
+
+			m_size += (uint64_t)delta;
+			return true;
+		}
+
+		// Pinned keys are never evicted, they can be pinned before they are loaded
+		// Returns false when the key already was or was not pinned
+		bool Pin(const Key & key, bool pin = true)
+		{
+			Shard & shard = GetShard(key);
+			std::lock_guard<std::mutex> locker(shard.lock);
+			if(pin ? !shard.pinned.insert(key).second : shard.pinned.erase(key) == 0)
+				return false;
+
+			auto it = shard.entries.find(key);
+			if(it != shard.entries.end()) {
+				Unlink(shard, it->second);
+				it->second.pinned = pin;
+				Link(shard, it->second);
+			}
+			return true;
+		}
+
+		// Evicts entries in policy order until the resident size is within the limit, pinned entries are skipped
+		void Shrink()
+		{
+			Shrink(GetLimit());
+		}
+
+		// The same down to target, e.g. below the limit so the next few loads do not have to evict again
+		void Shrink(uint64_t target)
+		{
+			while(GetResident() > target)
+			{
+				// Only the rank is copied out, the entry itself may be gone once its shard is unlocked
+				Shard * lowest = nullptr;
+				Entry lowestRank;
+				for(uint32_t i = 0; i <= m_shardMask; i++)
+				{
+					std::lock_guard<std::mutex> locker(m_shards[i]->lock);
+					const Entry * entry = GetLowest(*m_shards[i]);
+					if(entry && (!lowest || RankLess()(entry, &lowestRank))) {
+						lowest = m_shards[i].get();
+						lowestRank.priority = entry->priority;
+						lowestRank.tick = entry->tick;
+					}
+				}
+
+				if(!lowest)
+					break;
+
+				// The entry may have been used since, then this evicts whatever that shard has lowest now
+				// The returned value is only released at the end of this statement, after the shard is unlocked
+				EvictLowest(*lowest);
+			}
+		}
+
+		// Evicts everything not used since the clock read tick, see GetClock, pinned entries are kept
+		// Goes through every entry whatever the policy, so it is meant to run now and then rather than per use
+		uint64_t Expire(uint64_t tick)
+		{
+			uint64_t expired = 0;
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				Shard & shard = *m_shards[i];
+				std::vector<Value> values;	// Released once the shard is unlocked
+				std::lock_guard<std::mutex> locker(shard.lock);
+				for(auto it = shard.entries.begin(); it != shard.entries.end(); )
+				{
+					Entry & entry = it->second;
+					if(entry.pinned || entry.tick >= tick) {
+						++it;
+						continue;
+					}
+
+					Unlink(shard, entry);
+					m_size -= entry.size;
+					m_count--;
+					m_expirations++;
+					values.push_back(std::move(entry.value));
+					it = shard.entries.erase(it);
+					expired++;
+				}
+			}
+			return expired;
+		}
+
+		// Drops the empty values failed loads were completed with, so each is loaded again on its next use
+		// Goes through every entry like Expire, pinned keys included since there is nothing to keep
+		uint64_t ExpireEmpty()
+		{
+			uint64_t expired = 0;
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				Shard & shard = *m_shards[i];
+				std::lock_guard<std::mutex> locker(shard.lock);
+				for(auto it = shard.entries.begin(); it != shard.entries.end(); )
+				{
+					Entry & entry = it->second;
+					if(!(entry.value == Value())) {
+						++it;
+						continue;
+					}
+
+					Unlink(shard, entry);
+					m_size -= entry.size;
+					m_count--;
+					it = shard.entries.erase(it);
+					expired++;
+				}
+			}
+			return expired;
+		}
+
+		void Clear()
+		{
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				Shard & shard = *m_shards[i];
+				EntryMap entries(0, Hash(), Equal(), Allocator<std::pair<const Key, Entry>>(&m_overhead));
+				{
+					std::lock_guard<std::mutex> locker(shard.lock);
+					for(auto & it : shard.entries)
+					{
+						m_size -= it.second.size;
+						m_count--;
+					}
+					shard.head = shard.tail = nullptr;
+					shard.order.clear();
+					entries.swap(shard.entries);
+				}
+			}
+		}
+
+		// Calls func(key, value, size) for every entry, one shard locked at a time so func must not use the cache
+		template<typename F>
+		void ForEach(F && func)
+		{
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				std::lock_guard<std::mutex> locker(m_shards[i]->lock);
+				for(auto & it : m_shards[i]->entries)
+					func(it.first, it.second.value, it.second.size);
+			}
+		}
+
+		// Reorders everything that is cached for the new policy, nothing else may use the cache meanwhile
+		void SetPolicy(CachePolicy policy)
+		{
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				std::lock_guard<std::mutex> locker(m_shards[i]->lock);
+				for(auto & it : m_shards[i]->entries)
+					Unlink(*m_shards[i], it.second);
+			}
+
+			m_policy = policy;
+			for(uint32_t i = 0; i <= m_shardMask; i++)
+			{
+				std::lock_guard<std::mutex> locker(m_shards[i]->lock);
+				for(auto & it : m_shards[i]->entries)
+				{
+					Rank(it.second, true);
+					Link(*m_shards[i], it.second);
+				}
+			}
+		}
+
+		CachePolicy GetPolicy() const { return m_policy; }
+		// Sizes charged for the entries, then that plus the cache's own nodes, buckets and pending loads
+		uint64_t GetSize() const { return m_size.load(std::memory_order_relaxed); }
+		uint64_t GetOverhead() const { return (uint64_t)m_overhead.load(std::memory_order_relaxed); }
+		uint64_t GetResident() const { return GetSize() + GetOverhead(); }
+		uint64_t GetCount() const { return m_count.load(std::memory_order_relaxed); }
+		uint64_t GetLimit() const { return m_limit.load(std::memory_order_relaxed); }
+		void SetLimit(uint64_t limit) { m_limit = limit; }
+		// Only two atomic reads, cheap enough to ask on every use
+		bool IsOverLimit() const { return GetResident() > GetLimit(); }
+		// Advances on every use, entries remember when they were last used by it
+		uint64_t GetClock() const { return m_clock.load(std::memory_order_relaxed); }
+
+		uint64_t GetHits() const { return m_hits.load(std::memory_order_relaxed); }
+		uint64_t GetMisses() const { return m_misses.load(std::memory_order_relaxed); }
+		uint64_t GetEvictions() const { return m_evictions.load(std::memory_order_relaxed); }
+		uint64_t GetExpirations() const { return m_expirations.load(std::memory_order_relaxed); }
+
+	protected:
+		struct Entry
+		{
+			Entry() : key(nullptr), size(0), tick(0), uses(0), priority(0.0), pinned(false), prev(nullptr), next(nullptr) { }
+
+			const Key *	key;		// The key of the map node holding this entry
+			Value		value;
+			uint64_t	size;
+			uint64_t	tick;
+			uint64_t	uses;
+			double		priority;	// Lower goes first, equal ones by tick
+			bool		pinned;
+			Entry *		prev;
+			Entry *		next;
+		};
+
+		struct RankLess
+		{
+			bool operator()(const Entry * a, const Entry * b) const
+			{
+				if(a->priority != b->priority)
+					return a->priority < b->priority;
+				return a->tick < b->tick;
+			}
+		};
+
+		struct Load
+		{
+			std::promise<Value>			promise;
+			std::shared_future<Value>	future;
+		};
+
+		template<typename T>
+		using Allocator = CountingAllocator<T>;
+		typedef std::unordered_map<Key, Entry, Hash, Equal, Allocator<std::pair<const Key, Entry>>> EntryMap;
+		typedef std::unordered_map<Key, Load, Hash, Equal, Allocator<std::pair<const Key, Load>>> LoadMap;
+		typedef std::unordered_set<Key, Hash, Equal, Allocator<Key>> KeySet;
+		typedef std::set<Entry *, RankLess, Allocator<Entry *>> EntryOrder;
+
+		// Map nodes never move, so the list and the order can point at the entries in place
+		struct Shard
+		{
+			explicit Shard(std::atomic<int64_t> * overhead)
+				: entries(0, Hash(), Equal(), Allocator<std::pair<const Key, Entry>>(overhead)), loads(0, Hash(), Equal(), Allocator<std::pair<const Key, Load>>(overhead))
+				, pinned(0, Hash(), Equal(), Allocator<Key>(overhead)), head(nullptr), tail(nullptr), order(RankLess(), Allocator<Entry *>(overhead)) { }
+
+			std::mutex	lock;
+			EntryMap	entries;
+			LoadMap		loads;
+			KeySet		pinned;
+			Entry *		head;	// LRU only
+			Entry *		tail;
+			EntryOrder	order;	// Every other policy
+		};
+
+		Shard & GetShard(const Key & key)
+		{
+			size_t hash = Hash()(key);
+			return *m_shards[(hash ^ (hash >> 16)) & m_shardMask];
+		}
+
+		static double GetSizeCredit(uint64_t size)
+		{
+			return 1048576.0 / (double)(size ? size : 1);
+		}
+
+		// GreedyDual-Size with a cost of one, the inflation is the priority of the last eviction so old entries age out
+		void Rank(Entry & entry, bool reset)
+		{
+			entry.tick = ++m_clock;
+			entry.uses = reset ? 1 : entry.uses + 1;
+			switch(m_policy)
+			{
+			case kCachePolicyLFU:
+				entry.priority = (double)entry.uses;
+				break;
+			case kCachePolicyGreedyDualSize:
+				entry.priority = m_inflation.load(std::memory_order_relaxed) + GetSizeCredit(entry.size);
+				break;
+			default:
+				entry.priority = 0.0;
+				break;
+			}
+		}
+
+		void Link(Shard & shard, Entry & entry)
+		{
+			if(entry.pinned)
+				return;
+
+			if(m_policy != kCachePolicyLRU) {
+				shard.order.insert(&entry);
+				return;
+			}
+
+			entry.prev = nullptr;
+			entry.next = shard.head;
+			if(shard.head)
+				shard.head->prev = &entry;
+			shard.head = &entry;
+			if(!shard.tail)
+				shard.tail = &entry;
+		}
+
+		void Unlink(Shard & shard, Entry & entry)
+		{
+			if(entry.pinned)
+				return;
+
+			if(m_policy != kCachePolicyLRU) {
+				shard.order.erase(&entry);
+				return;
+			}
+
+			if(entry.prev)
+				entry.prev->next = entry.next;
+			else
+				shard.head = entry.next;
+			if(entry.next)
+				entry.next->prev = entry.prev;
+			else
+				shard.tail = entry.prev;
+			entry.prev = entry.next = nullptr;
+		}
+
+		void Touch(Shard & shard, Entry & entry)
+		{
+			Unlink(shard, entry);
+			Rank(entry, false);
+			Link(shard, entry);
+		}
+
+		Entry * GetLowest(Shard & shard)
+		{
+			if(m_policy == kCachePolicyLRU)
+				return shard.tail;
+			return shard.order.empty() ? nullptr : *shard.order.begin();
+		}
+
+		// Locks the shard itself, the value is handed back to be released outside the lock
+		Value EvictLowest(Shard & shard)
+		{
+			std::lock_guard<std::mutex> locker(shard.lock);
+			Entry * entry = GetLowest(shard);
+			return entry ? Evict(shard, *entry) : Value();
+		}
+
+		// Hands the value back so the caller can release it outside the lock
+		Value Evict(Shard & shard, Entry & entry)
+		{
+			Unlink(shard, entry);
+			m_size -= entry.size;
+			m_count--;
+			m_evictions++;
+
+			double inflation = m_inflation.load(std::memory_order_relaxed);
+			while(entry.priority > inflation && !m_inflation.compare_exchange_weak(inflation, entry.priority));
+
+			Value value = std::move(entry.value);
+			Key key = *entry.key;
+			shard.entries.erase(key);
+			return value;
+		}
+
+		std::atomic<int64_t>					m_overhead;	// Declared first so it outlives the shards counting into it
+		std::vector<std::unique_ptr<Shard>>		m_shards;
+		uint32_t								m_shardMask;
+		CachePolicy								m_policy;
+		std::atomic<uint64_t>					m_limit;
+		std::atomic<uint64_t>					m_size;
+		std::atomic<uint64_t>					m_count;
+		std::atomic<uint64_t>					m_clock;
+		std::atomic<double>						m_inflation;
+		std::atomic<uint64_t>					m_hits;
+		std::atomic<uint64_t>					m_misses;
+		std::atomic<uint64_t>					m_evictions;
+		std::atomic<uint64_t>					m_expirations;
+	};
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cctype>
+
+// Case insensitive FNV-1a, the hash every F4EEFixedString carries
+inline size_t HashLower(const char * str, size_t count)
+{
+	const size_t _FNV_offset_basis = 14695981039346656037ULL;
+	const size_t _FNV_prime = 1099511628211ULL;
+
+	size_t _Val = _FNV_offset_basis;
+	for (size_t _Next = 0; _Next < count; ++_Next)
+	{	// fold in another byte
+		_Val ^= (size_t)tolower(str[_Next]);
+		_Val *= _FNV_prime;
+	}
+	return _Val;
+}
+
+// Compares a terminated string against count characters the way F4EEFixedString does, ignoring case
+inline bool EqualLower(const char * str, const char * other, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (str[i] == 0 || tolower(str[i]) != tolower(other[i]))
+			return false;
+	}
+	return str[count] == 0;
+}
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "f4se/GameTypes.h"
+#include "StringHash.h"
 
 struct F4SESerializationInterface;
 
@@ -39,16 +40,7 @@ public:
 
 	size_t hash_lower(const char * str, size_t count)
 	{
-		const size_t _FNV_offset_basis = 14695981039346656037ULL;
-		const size_t _FNV_prime = 1099511628211ULL;
-
-		size_t _Val = _FNV_offset_basis;
-		for (size_t _Next = 0; _Next < count; ++_Next)
-		{	// fold in another byte
-			_Val ^= (size_t)tolower(str[_Next]);
-			_Val *= _FNV_prime;
-		}
-		return _Val;
+		return HashLower(str, count);
 	}
 
 	size_t GetHash() const
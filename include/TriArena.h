@@ -0,0 +1,137 @@
+#pragma once
+
+#include "MorphDeltas.h"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Every morph of one TRI file in a single block: shape directory, morph directory, morph bounds, deltas, then the names
+	// Both directories are sorted by name hash, so lookups are a binary search and a name compare
+	class TriArena
+	{
+	public:
+		struct Shape
+		{
+			uint64_t	hash;
+			uint32_t	name;		// Offset into the names
+			uint32_t	firstMorph;
+			uint32_t	numMorphs;
+			uint32_t	reserved;
+		};
+
+		struct Morph
+		{
+			uint64_t	hash;
+			uint32_t	name;		// Offset into the names
+			uint32_t	firstDelta;
+			uint32_t	numDeltas;
+			float		multiplier;	// Packed files only, 0 otherwise
+		};
+
+		// Box around the deltas of a morph at full strength, multiplier applied
+		struct Bounds
+		{
+			float	min[3];
+			float	max[3];
+			float	maxDisplacement;	// Length of the longest delta, how far the morph moves any vertex at a value of 1
+		};
+
+		// Identifies the file an arena was parsed from, a saved arena is only used while this still matches
+		// Fields that cannot be known cheaply are left 0, e.g. the time of a file inside an archive
+		struct SourceKey
+		{
+			SourceKey() : size(0), time(0), hash(0) { }
+
+			bool operator==(const SourceKey & other) const { return size == other.size && time == other.time && hash == other.hash; }
+
+			uint64_t	size;
+			uint64_t	time;
+			uint64_t	hash;
+		};
+
+		TriArena() : m_packed(false), m_quantized(false), m_deltasReleased(false), m_quantizationError(0.0f), m_numShapes(0), m_numMorphs(0), m_numDeltas(0), m_data(nullptr), m_size(0), m_error(nullptr), m_errorOffset(0) { }
+
+		// Reads a 'TRI\0' or 'TRIP' file, on failure the arena is left empty
+		// Like inserting into a map, only the first of several shapes or morphs with the same name is kept
+		bool Parse(const uint8_t * data, size_t size);
+		void Clear();
+
+		// Writes the arena as a cache image, '.f4eemorph' files hold exactly this
+		// Layout: header (magic, version, key, counts, block size), then the block as it is in memory
+		// Only while HasDeltas(), nothing is written after ReleaseDeltas
+		void Save(const SourceKey & key, std::vector<uint8_t> & out) const;
+
+		// Uses a cache image in place without copying it, owner keeps the memory alive (e.g. a mapped view)
+		// Fails on images from another version, for another source key, or with anything out of range
+		bool Load(const uint8_t * data, size_t size, const SourceKey & key, const std::shared_ptr<const void> & owner);
+
+		// Converts the deltas of a 'TRI\0' arena to the 16 bit ones of 'TRIP' files, with a multiplier per morph
+		// Nothing changes when the largest error that would be introduced is over maxError, the arena then stays full precision
+		// Either way error is that largest error, in the units of the deltas
+		bool Quantize(float maxError, float & error);
+
+		// Drops the deltas once they were copied elsewhere (e.g. into a MorphMatrix), directories, bounds and names stay
+		// The rest moves into a smaller owned block, so Shape and Morph pointers taken before are invalid afterwards
+		void ReleaseDeltas();
+
+		// Content hash for sources whose time is unknown
+		static uint64_t HashSource(const uint8_t * data, size_t size);
+
+		bool IsPacked() const { return m_packed; }
+		// Packed by Quantize rather than read that way, saved images keep this and the error
+		// A full precision arena keeps the error of a Quantize that was over its limit, 0 when there was none
+		bool IsQuantized() const { return m_quantized; }
+		float GetQuantizationError() const { return m_quantizationError; }
+		uint32_t GetShapeCount() const { return m_numShapes; }
+		uint32_t GetMorphCount() const { return m_numMorphs; }
+		uint32_t GetDeltaCount() const { return m_numDeltas; }
+		bool HasDeltas() const { return !m_deltasReleased; }
+
+		const Shape * GetShapes() const { return (const Shape *)m_data; }
+		const Morph * GetMorphs() const { return (const Morph *)(m_data + MorphsOffset()); }
+		const Bounds & GetBounds(const Morph & morph) const { return ((const Bounds *)(m_data + BoundsOffset()))[&morph - GetMorphs()]; }
+		const char * GetName(uint32_t offset) const { return (const char *)m_data + NamesOffset() + offset; }
+
+		// Name hashes are HashLower of the name, the same one F4EEFixedString carries
+		const Shape * FindShape(const char * name, size_t length, uint64_t hash) const;
+		const Morph * FindMorph(const Shape & shape, const char * name, size_t length, uint64_t hash) const;
+
+		// Use the variant matching IsPacked(), only while HasDeltas()
+		const TriVertexDelta * GetDeltas(const Morph & morph) const { return (const TriVertexDelta *)(m_data + DeltasOffset()) + morph.firstDelta; }
+		const TriPackedVertexDelta * GetPackedDeltas(const Morph & morph) const { return (const TriPackedVertexDelta *)(m_data + DeltasOffset()) + morph.firstDelta; }
+
+		// Bytes of the block, owned or mapped, the arena object itself is not included
+		size_t GetMemoryUsage() const { return m_block.empty() ? m_size : m_block.capacity(); }
+
+		// Why and where the last Parse or Load failed
+		const char * GetError() const { return m_error; }
+		size_t GetErrorOffset() const { return m_errorOffset; }
+
+	protected:
+		size_t DeltaSize() const { return m_packed ? sizeof(TriPackedVertexDelta) : sizeof(TriVertexDelta); }
+		size_t MorphsOffset() const { return (size_t)m_numShapes * sizeof(Shape); }
+		size_t BoundsOffset() const { return MorphsOffset() + (size_t)m_numMorphs * sizeof(Morph); }
+		size_t DeltasOffset() const { return BoundsOffset() + (size_t)m_numMorphs * sizeof(Bounds); }
+		size_t NamesOffset() const { return DeltasOffset() + (m_deltasReleased ? 0 : (size_t)m_numDeltas * DeltaSize()); }
+
+		bool Fail(const char * error, size_t offset = 0) { Clear(); m_error = error; m_errorOffset = offset; return false; }
+
+		bool						m_packed;
+		bool						m_quantized;
+		bool						m_deltasReleased;	// Counts and offsets of the morphs still describe them
+		float						m_quantizationError;
+		uint32_t					m_numShapes;
+		uint32_t					m_numMorphs;
+		uint32_t					m_numDeltas;
+		const uint8_t *				m_data;		// Either the owned block or memory kept alive by the owner
+		size_t						m_size;
+		std::vector<uint8_t>		m_block;
+		std::shared_ptr<const void>	m_owner;
+		const char *				m_error;
+		size_t						m_errorOffset;
+	};
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "MorphDeltas.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace Morpher
+{
+	// Bounds checked cursor over the bytes of a TRI file, nothing is copied except the names
+	// Layout: header, then per shape its name and morphs, then per morph its name and deltas
+	class TriReader
+	{
+	public:
+		enum
+		{
+			kFormatFull = 0x54524900,	// 'TRI\0'
+			kFormatPacked = 0x54524950,	// 'TRIP'
+			kMaxMorphVertices = 0xFFFF,
+		};
+
+		TriReader(const uint8_t * data, size_t size) : m_data(data), m_size(size), m_offset(0), m_packed(false), m_shapeCount(0), m_error(nullptr) { }
+
+		// Reads the format and shape count, fails on anything that is not a TRI file
+		bool ReadHeader();
+
+		bool IsPacked() const { return m_packed; }
+		uint32_t GetShapeCount() const { return m_shapeCount; }
+
+		// Name of the next shape and the number of morphs following it
+		bool ReadShape(std::string & name, uint32_t & morphCount);
+
+		// Name of the next morph, its multiplier (packed files only, 0 otherwise) and the number of deltas following it
+		// The delta count is checked against the remaining bytes, so it can be used to size the output up front
+		bool ReadMorph(std::string & name, float & multiplier, uint32_t & vertexCount);
+
+		// Reads the deltas of the current morph, use the variant matching IsPacked()
+		bool ReadDeltas(TriVertexDelta * deltas, uint32_t count);
+		bool ReadDeltas(TriPackedVertexDelta * deltas, uint32_t count);
+
+		size_t GetOffset() const { return m_offset; }
+		// Moves to an offset returned by GetOffset, used to skip deltas and come back for them later
+		bool Seek(size_t offset) { if(offset > m_size) return Fail("unexpected end of file"); m_offset = offset; return true; }
+		size_t GetSize() const { return m_size; }
+		bool IsAtEnd() const { return m_offset == m_size; }
+
+		// Reason the last read failed, null if none did
+		const char * GetError() const { return m_error; }
+
+		// Bytes one delta occupies in the file
+		static size_t GetDeltaSize(bool packed) { return packed ? 8 : 16; }
+
+	protected:
+		bool Fail(const char * error) { m_error = error; return false; }
+		bool Has(size_t bytes) const { return bytes <= m_size - m_offset; }
+		bool ReadName(std::string & name);
+		bool ReadCount(uint32_t & count);
+
+		template<typename T>
+		bool Read(T & value);
+
+		const uint8_t *	m_data;
+		size_t			m_size;
+		size_t			m_offset;
+		bool			m_packed;
+		uint32_t		m_shapeCount;
+		const char *	m_error;
+	};
+}
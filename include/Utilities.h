@@ -3,11 +3,13 @@
 #include "f4se/PluginAPI.h"
 #include "f4se/GameTypes.h"
 #include "f4se/NiTypes.h"
+#include "f4se/NiNodes.h"
 #include "StringTable.h"
 
 #include <cmath>
 #include <string>
 #include <functional>
+#include <vector>
 
 class BSResourceNiBinaryStream;
 class NiAVObject;
@@ -67,7 +69,31 @@ static bool AreEqual(T f1, T f2) {
 }
 
 void BSReadAll(BSResourceNiBinaryStream* fin, std::string* str);
+// Reads the rest of the stream in large chunks, for binary files parsed from memory
+void BSReadAll(BSResourceNiBinaryStream* fin, std::vector<UInt8>* data);
 bool VisitObjects(NiAVObject * parent, std::function<bool(NiAVObject*)> functor);
+
+// Same walk for any callable, the functor is passed down by reference and its call can be inlined
+template<typename F>
+bool VisitObjects(NiAVObject * parent, F && functor)
+{
+	if (functor(parent))
+		return true;
+
+	NiPointer<NiNode> node(parent->GetAsNiNode());
+	if(node) {
+		for(UInt32 i = 0; i < node->m_children.m_emptyRunStart; i++) {
+			NiPointer<NiAVObject> object(node->m_children.m_data[i]);
+			if(object) {
+				if (VisitObjects((NiAVObject*)object, functor))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 void VisitLeveledCharacter(TESLevCharacter * character, std::function<void(TESNPC*)> functor);
 
 // Travels up a node tree to determine the right node
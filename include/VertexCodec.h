@@ -0,0 +1,34 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <cstdint>
+
+namespace Morpher
+{
+	// Describes where the attributes touched by the morpher live inside one interleaved vertex
+	struct VertexLayout
+	{
+		VertexLayout() : stride(0), fullPrecision(false), hasUVs(false), hasNormals(false), hasTangents(false) { }
+
+		// Position is followed by the bitangent X, either as floats or halves
+		uint32_t PositionSize() const { return fullPrecision ? 16 : 8; }
+		uint32_t UVOffset() const { return PositionSize(); }
+		uint32_t NormalOffset() const { return UVOffset() + (hasUVs ? 4 : 0); }
+		uint32_t TangentOffset() const { return NormalOffset() + 4; }
+
+		uint32_t	stride;
+		bool		fullPrecision;
+		bool		hasUVs;
+		bool		hasNormals;
+		bool		hasTangents;
+	};
+
+	// Splits the interleaved vertex block into position and uv streams, uvs may be null
+	void DecodeVertices(const VertexLayout & layout, const uint8_t * block, uint32_t numVertices, Vector3 * positions, Vector2 * uvs);
+
+	// Packs positions and the tangent frame back into the interleaved vertex block
+	// When normals is null only the positions are written, everything else is left untouched
+	// With a frame mask only flagged vertices get their frame written, the others keep the one in the block
+	void EncodeVertices(const VertexLayout & layout, uint8_t * block, uint32_t numVertices, const Vector3 * positions, const Vector3 * normals, const Vector3 * tangents, const Vector3 * bitangents, const uint8_t * frameMask = nullptr);
+}
@@ -176,6 +176,15 @@
 	#define HALF_NOTHROW	throw()
 #endif
 
+//enable runtime dispatched F16C bulk conversion on x86/x64 (define to 0 to always use the tables)
+#ifndef HALF_ENABLE_F16C_DISPATCH
+	#if defined(_M_X64) || defined(__x86_64__)
+		#define HALF_ENABLE_F16C_DISPATCH	1
+	#else
+		#define HALF_ENABLE_F16C_DISPATCH	0
+	#endif
+#endif
+
 #include <algorithm>
 #include <iostream>
 #include <limits>
@@ -191,6 +200,18 @@
 #if HALF_ENABLE_CPP11_HASH
 	#include <functional>
 #endif
+#if HALF_ENABLE_F16C_DISPATCH
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define HALF_TARGET_F16C
+		#define HALF_TARGET_AVX2
+	#else
+		#include <cpuid.h>
+		#define HALF_TARGET_F16C	__attribute__((target("avx,f16c")))
+		#define HALF_TARGET_AVX2	__attribute__((target("avx2,f16c")))
+	#endif
+#endif
 
 
 /// Default rounding mode.
@@ -2940,6 +2961,203 @@ namespace half_float
 	using detail::isunordered;
 
 	using detail::half_cast;
+
+	namespace detail
+	{
+	#if HALF_ENABLE_F16C_DISPATCH
+		/// Instruction sets usable for bulk conversion.
+		enum simd_level { simd_none, simd_f16c, simd_avx2 };
+
+		/// Query the processor and operating system for conversion instructions.
+		/// F16C and AVX2 are VEX encoded, so besides the CPUID bits the OS has to save the AVX register state.
+		/// \return best instruction set usable for bulk conversion
+		inline simd_level detect_simd_level()
+		{
+			unsigned int leaf1[4] = { 0, 0, 0, 0 }, leaf7[4] = { 0, 0, 0, 0 };
+		#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			int max_leaf = info[0];
+			__cpuid(info, 1);
+			std::memcpy(leaf1, info, sizeof(leaf1));
+			if(max_leaf >= 7)
+			{
+				__cpuidex(info, 7, 0);
+				std::memcpy(leaf7, info, sizeof(leaf7));
+			}
+		#else
+			if(!__get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]))
+				return simd_none;
+			if(__get_cpuid_max(0, 0) >= 7)
+				__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+		#endif
+			const unsigned int required = (1U<<27) | (1U<<28) | (1U<<29);		// OSXSAVE, AVX, F16C
+			if((leaf1[2]&required) != required)
+				return simd_none;
+		#if defined(_MSC_VER)
+			unsigned long long xcr0 = _xgetbv(0);
+		#else
+			unsigned int xcr0_lo, xcr0_hi;
+			__asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+			unsigned long long xcr0 = (static_cast<unsigned long long>(xcr0_hi)<<32) | xcr0_lo;
+		#endif
+			if((xcr0&6) != 6)
+				return simd_none;
+			return (leaf7[1]&(1U<<5)) ? simd_avx2 : simd_f16c;
+		}
+
+		/// Instruction set used for bulk conversion, detected on first use.
+		/// \return best instruction set usable for bulk conversion
+		inline simd_level bulk_simd_level()
+		{
+			static const simd_level level = detect_simd_level();
+			return level;
+		}
+
+		/// F16C rounding control reproducing a rounding mode of the table based conversion.
+		/// Modes the hardware cannot reproduce bit-exactly (indeterminate rounding overflows to infinity, round to nearest 
+		/// breaks ties away from zero unless HALF_ROUND_TIES_TO_EVEN is set) map to `-1` and always use the tables.
+		template<std::float_round_style R> struct f16c_rounding { enum { value = -1 }; };
+		template<> struct f16c_rounding<std::round_toward_zero> { enum { value = _MM_FROUND_TO_ZERO }; };
+		template<> struct f16c_rounding<std::round_toward_infinity> { enum { value = _MM_FROUND_TO_POS_INF }; };
+		template<> struct f16c_rounding<std::round_toward_neg_infinity> { enum { value = _MM_FROUND_TO_NEG_INF }; };
+	#if HALF_ROUND_TIES_TO_EVEN
+		template<> struct f16c_rounding<std::round_to_nearest> { enum { value = _MM_FROUND_TO_NEAREST_INT }; };
+	#endif
+
+		/// Convert half-precision to single-precision four values at a time.
+		HALF_TARGET_F16C inline void half2float_f16c(const uint16 *src, float *dst, std::size_t n)
+		{
+			std::size_t i = 0;
+			for(; i+4<=n; i+=4)
+				_mm_storeu_ps(dst+i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src+i))));
+			for(; i<n; ++i)
+				dst[i] = _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(src[i])));
+		}
+
+		/// Convert half-precision to single-precision sixteen values at a time.
+		HALF_TARGET_AVX2 inline void half2float_avx2(const uint16 *src, float *dst, std::size_t n)
+		{
+			std::size_t i = 0;
+			for(; i+16<=n; i+=16)
+			{
+				__m256 lo = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i)));
+				__m256 hi = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i+8)));
+				_mm256_storeu_ps(dst+i, lo);
+				_mm256_storeu_ps(dst+i+8, hi);
+			}
+			for(; i+8<=n; i+=8)
+				_mm256_storeu_ps(dst+i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i))));
+			for(; i<n; ++i)
+				dst[i] = _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(src[i])));
+		}
+
+		/// Convert single-precision to half-precision four values at a time.
+		/// \tparam M F16C rounding control
+		template<int M> HALF_TARGET_F16C inline void float2half_f16c(const float *src, uint16 *dst, std::size_t n)
+		{
+			std::size_t i = 0;
+			for(; i+4<=n; i+=4)
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(dst+i), _mm_cvtps_ph(_mm_loadu_ps(src+i), M));
+			for(; i<n; ++i)
+				dst[i] = static_cast<uint16>(_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(src[i]), M)));
+		}
+
+		/// Convert single-precision to half-precision sixteen values at a time.
+		/// \tparam M F16C rounding control
+		template<int M> HALF_TARGET_AVX2 inline void float2half_avx2(const float *src, uint16 *dst, std::size_t n)
+		{
+			std::size_t i = 0;
+			for(; i+16<=n; i+=16)
+			{
+				__m128i lo = _mm256_cvtps_ph(_mm256_loadu_ps(src+i), M);
+				__m128i hi = _mm256_cvtps_ph(_mm256_loadu_ps(src+i+8), M);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), lo);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i+8), hi);
+			}
+			for(; i+8<=n; i+=8)
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), _mm256_cvtps_ph(_mm256_loadu_ps(src+i), M));
+			for(; i<n; ++i)
+				dst[i] = static_cast<uint16>(_mm_cvtsi128_si32(_mm_cvtps_ph(_mm_set_ss(src[i]), M)));
+		}
+
+		/// Dispatch bulk single to half-precision conversion for rounding modes the hardware can reproduce.
+		template<std::float_round_style R> bool float2half_simd(const float *src, uint16 *dst, std::size_t n, true_type)
+		{
+			switch(bulk_simd_level())
+			{
+			case simd_avx2:
+				float2half_avx2<f16c_rounding<R>::value>(src, dst, n);
+				return true;
+			case simd_f16c:
+				float2half_f16c<f16c_rounding<R>::value>(src, dst, n);
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		/// Rounding modes the hardware cannot reproduce always take the table based path.
+		template<std::float_round_style R> bool float2half_simd(const float*, uint16*, std::size_t, false_type) { return false; }
+	#endif
+	}
+
+	/// \name Bulk conversion
+	/// \{
+
+	/// Convert an array of half-precision values to single-precision.
+	/// Results are bit-identical to converting every value through a [half](\ref half), except that the hardware path 
+	/// returns quiet NaNs for signaling NaN inputs.
+	/// \param src binary representations of half-precision values
+	/// \param dst array receiving the single-precision values, must not overlap \a src
+	/// \param n number of values to convert
+	inline void half_to_float(const detail::uint16 *src, float *dst, std::size_t n)
+	{
+	#if HALF_ENABLE_F16C_DISPATCH
+		switch(detail::bulk_simd_level())
+		{
+		case detail::simd_avx2:
+			detail::half2float_avx2(src, dst, n);
+			return;
+		case detail::simd_f16c:
+			detail::half2float_f16c(src, dst, n);
+			return;
+		default:
+			break;
+		}
+	#endif
+		for(std::size_t i=0; i<n; ++i)
+			dst[i] = detail::half2float<float>(src[i]);
+	}
+
+	/// Convert an array of single-precision values to half-precision.
+	/// Results are bit-identical to the table based conversion for rounding mode \a R for all non-NaN inputs (the tables 
+	/// turn NaNs whose payload lies entirely in the discarded bits into infinity, the hardware keeps them NaN).
+	/// \tparam R rounding mode to use
+	/// \param src single-precision values
+	/// \param dst array receiving the binary representations of the half-precision values, must not overlap \a src
+	/// \param n number of values to convert
+	template<std::float_round_style R> void float_to_half(const float *src, detail::uint16 *dst, std::size_t n)
+	{
+	#if HALF_ENABLE_F16C_DISPATCH
+		if(detail::float2half_simd<R>(src, dst, n, detail::bool_type<detail::f16c_rounding<R>::value!=-1>()))
+			return;
+	#endif
+		for(std::size_t i=0; i<n; ++i)
+			dst[i] = detail::float2half<R>(src[i]);
+	}
+
+	/// Convert an array of single-precision values to half-precision.
+	/// Rounds like assigning the values to a [half](\ref half), using the default HALF_ROUND_STYLE.
+	/// \param src single-precision values
+	/// \param dst array receiving the binary representations of the half-precision values, must not overlap \a src
+	/// \param n number of values to convert
+	inline void float_to_half(const float *src, detail::uint16 *dst, std::size_t n)
+	{
+		float_to_half<(std::float_round_style)(HALF_ROUND_STYLE)>(src, dst, n);
+	}
+
+	/// \}
 }
 
 
@@ -3059,6 +3277,8 @@ namespace std
 #undef HALF_CONSTEXPR_CONST
 #undef HALF_NOEXCEPT
 #undef HALF_NOTHROW
+#undef HALF_TARGET_F16C
+#undef HALF_TARGET_AVX2
 #ifdef HALF_POP_WARNINGS
 	#pragma warning(pop)
 	#undef HALF_POP_WARNINGS
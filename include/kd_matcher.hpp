@@ -7,6 +7,7 @@ See the included LICENSE file
 #pragma once
 
 #include "shape.hpp"
+#include <cfloat>
 #include <map>
 #include <algorithm>
 
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <stdint.h>
+#include <cmath>
 
 const double EPSILON = 0.0001;
 
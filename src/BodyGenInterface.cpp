@@ -1,5 +1,6 @@
 #include "BodyGenInterface.h"
 #include "Utilities.h"
+#include "BodyGenParser.h"
 
 #include <stdlib.h>
 #include <random>
@@ -40,113 +41,41 @@ bool BodyGenInterface::ReadBodyMorphTemplates(const std::string & filePath)
 		if (str.at(0) == '#')
 			continue;
 
-		std::vector<std::string> side = std::explode(str, '=');
-		if (side.size() < 2) {
+		std::string lSide, rSide;
+		if (!BodyGen::SplitLine(str, lSide, rSide)) {
 			_ERROR("%s - Error - Template has no left-hand side.\tLine (%d) [%s]", __FUNCTION__, lineCount, filePath.c_str());
 			continue;
 		}
 
-		std::string lSide = std::trim(side[0]);
-		std::string rSide = std::trim(side[1]);
-
 		F4EEFixedString templateName = lSide.c_str();
 
-		BodyGenTemplatePtr bodyGenSets = std::make_shared<BodyGenTemplate>();
-
+		BodyGen::TemplateSets sets;
 		std::string error = "";
-		std::vector<std::string> sets = std::explode(rSide, '/');
-		for (UInt32 i = 0; i < sets.size(); i++) {
-			sets[i] = std::trim(sets[i]);
+		if (!BodyGen::ParseTemplate(rSide, sets, error)) {
+			_ERROR("%s - Error - Could not parse morphs %s.\tLine (%d) [%s]", __FUNCTION__, error.c_str(), lineCount, filePath.c_str());
+			continue;
+		}
 
+		BodyGenTemplatePtr bodyGenSets = std::make_shared<BodyGenTemplate>();
+		bodyGenSets->reserve(sets.size());
+		for (auto & set : sets) {
 			BodyGenMorphs bodyMorphs;
-
-			std::vector<std::string> morphs = std::explode(sets[i], ',');
-			for (UInt32 j = 0; j < morphs.size(); j++) {
-				morphs[j] = std::trim(morphs[j]);
-
-				std::vector<std::string> selectors = std::explode(morphs[j], '|');
-
+			bodyMorphs.reserve(set.size());
+			for (auto & selectors : set) {
 				BodyGenMorphSelector selector;
-
-				for (UInt32 k = 0; k < selectors.size(); k++) {
-					selectors[k] = std::trim(selectors[k]);
-
-					std::vector<std::string> pairs = std::explode(selectors[k], '@');
-					if (pairs.size() < 2) {
-						error = "Must have value pair with @ (";
-						error += selectors[k];
-						error += ")";
-						break;
-					}
-
-					std::string morphName = std::trim(pairs[0]);
-					if (morphName.length() == 0) {
-						error = "Empty morph name";
-						break;
-					}
-
-					std::string morphValues = std::trim(pairs[1]);
-					if (morphValues.length() == 0) {
-						error = "Empty values for (";
-						error += morphName;
-						error += ")";
-						break;
-					}
-
-					float lowerValue = 0;
-					float upperValue = 0;
-
-					std::vector<std::string> range = std::explode(morphValues, ':');
-					if (range.size() > 1) {
-						std::string lowerRange = std::trim(range[0]);
-						if (lowerRange.length() == 0) {
-							error = "Empty lower range for (";
-							error += morphName;
-							error += ")";
-							break;
-						}
-
-						lowerValue = atof(lowerRange.c_str());
-
-						std::string upperRange = std::trim(range[1]);
-						if (upperRange.length() == 0) {
-							error = "Empty upper range for (";
-							error += morphName;
-							error += ")";
-							break;
-						}
-
-						upperValue = atof(upperRange.c_str());
-					}
-					else {
-						lowerValue = atof(morphValues.c_str());
-						upperValue = lowerValue;
-					}
-
+				selector.reserve(selectors.size());
+				for (auto & range : selectors) {
 					BodyGenMorphData morphData;
-					morphData.name = morphName.c_str();
-					morphData.lower = lowerValue;
-					morphData.upper = upperValue;
+					morphData.name = range.name.c_str();
+					morphData.lower = range.lower;
+					morphData.upper = range.upper;
 					selector.push_back(morphData);
 				}
-
-				if (error.length() > 0)
-					break;
-
 				bodyMorphs.push_back(selector);
 			}
-
-			if (error.length() > 0)
-				break;
-
 			bodyGenSets->push_back(bodyMorphs);
 		}
 
-		if (error.length() > 0) {
-			_ERROR("%s - Error - Could not parse morphs %s.\tLine (%d) [%s]", __FUNCTION__, error.c_str(), lineCount, filePath.c_str());
-			continue;
-		}
-
 		if (bodyGenSets->size() > 0) {
 			bodyGenTemplates[templateName] = bodyGenSets;
 			loadedTemplates++;
@@ -207,15 +136,12 @@ bool BodyGenInterface::ReadBodyMorphs(const std::string & filePath)
 		if (str.at(0) == '#')
 			continue;
 
-		std::vector<std::string> side = std::explode(str, '=');
-		if (side.size() < 2) {
+		std::string lSide, rSide;
+		if (!BodyGen::SplitLine(str, lSide, rSide)) {
 			_ERROR("%s - Error - Morph has no left-hand side.\tLine (%d) [%s]", __FUNCTION__, lineCount, filePath.c_str());
 			continue;
 		}
 
-		std::string lSide = std::trim(side[0]);
-		std::string rSide = std::trim(side[1]);
-
 		std::vector<std::string> form = std::explode(lSide, '|');
 		if (form.size() < 2) {
 			_ERROR("%s - Error - Morph left side missing mod name or formID.\tLine (%d) [%s]", __FUNCTION__, lineCount, filePath.c_str());
@@ -362,15 +288,12 @@ bool BodyGenInterface::ReadBodyMorphs(const std::string & filePath)
 		}
 
 		BodyGenDataTemplatesPtr dataTemplates = std::make_shared<BodyGenDataTemplates>();
-		std::string error = "";
-		std::vector<std::string> sets = std::explode(rSide, ',');
-		for (UInt32 i = 0; i < sets.size(); i++) {
-			sets[i] = std::trim(sets[i]);
-			std::vector<std::string> selectors = std::explode(sets[i], '|');
+		std::vector<std::vector<std::string>> slots;
+		BodyGen::ParseTemplateSlots(rSide, slots);
+		for (auto & selectors : slots) {
 			BodyTemplateList templateList;
-			for (UInt32 k = 0; k < selectors.size(); k++) {
-				selectors[k] = std::trim(selectors[k]);
-				F4EEFixedString templateName(selectors[k].c_str());
+			for (auto & selectorName : selectors) {
+				F4EEFixedString templateName(selectorName.c_str());
 				auto & temp = bodyGenTemplates.find(templateName);
 				if (temp != bodyGenTemplates.end())
 					templateList.push_back(temp->second);
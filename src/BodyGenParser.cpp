@@ -0,0 +1,137 @@
+#include "BodyGenParser.h"
+
+#include <cctype>
+#include <cstdlib>
+
+namespace BodyGen
+{
+	std::vector<std::string> Explode(const std::string & str, char ch)
+	{
+		std::vector<std::string> result;
+
+		size_t start = 0;
+		for (size_t i = 0; i <= str.size(); i++)
+		{
+			if (i == str.size() || str[i] == ch) {
+				if (i > start)
+					result.emplace_back(str, start, i - start);
+				start = i + 1;
+			}
+		}
+
+		return result;
+	}
+
+	std::string Trim(const std::string & str)
+	{
+		size_t begin = 0;
+		size_t end = str.size();
+		while (begin < end && isspace((unsigned char)str[begin]))
+			begin++;
+		while (end > begin && isspace((unsigned char)str[end - 1]))
+			end--;
+		return str.substr(begin, end - begin);
+	}
+
+	bool SplitLine(const std::string & line, std::string & lSide, std::string & rSide)
+	{
+		std::vector<std::string> side = Explode(line, '=');
+		if (side.size() < 2)
+			return false;
+
+		lSide = Trim(side[0]);
+		rSide = Trim(side[1]);
+		return true;
+	}
+
+	bool ParseTemplate(const std::string & rSide, TemplateSets & sets, std::string & error)
+	{
+		sets.clear();
+
+		std::vector<std::string> setTexts = Explode(rSide, '/');
+		sets.reserve(setTexts.size());
+		for (auto & setText : setTexts)
+		{
+			MorphSet morphSet;
+
+			std::vector<std::string> morphs = Explode(Trim(setText), ',');
+			morphSet.reserve(morphs.size());
+			for (auto & morph : morphs)
+			{
+				MorphSelector selector;
+
+				std::vector<std::string> selectors = Explode(Trim(morph), '|');
+				selector.reserve(selectors.size());
+				for (auto & selectorText : selectors)
+				{
+					std::string trimmed = Trim(selectorText);
+
+					std::vector<std::string> pairs = Explode(trimmed, '@');
+					if (pairs.size() < 2) {
+						error = "Must have value pair with @ (" + trimmed + ")";
+						return false;
+					}
+
+					MorphRange range;
+					range.name = Trim(pairs[0]);
+					if (range.name.length() == 0) {
+						error = "Empty morph name";
+						return false;
+					}
+
+					std::string morphValues = Trim(pairs[1]);
+					if (morphValues.length() == 0) {
+						error = "Empty values for (" + range.name + ")";
+						return false;
+					}
+
+					std::vector<std::string> bounds = Explode(morphValues, ':');
+					if (bounds.size() > 1) {
+						std::string lowerRange = Trim(bounds[0]);
+						if (lowerRange.length() == 0) {
+							error = "Empty lower range for (" + range.name + ")";
+							return false;
+						}
+
+						std::string upperRange = Trim(bounds[1]);
+						if (upperRange.length() == 0) {
+							error = "Empty upper range for (" + range.name + ")";
+							return false;
+						}
+
+						range.lower = (float)atof(lowerRange.c_str());
+						range.upper = (float)atof(upperRange.c_str());
+					}
+					else {
+						range.lower = (float)atof(morphValues.c_str());
+						range.upper = range.lower;
+					}
+
+					selector.push_back(std::move(range));
+				}
+
+				morphSet.push_back(std::move(selector));
+			}
+
+			sets.push_back(std::move(morphSet));
+		}
+
+		return true;
+	}
+
+	void ParseTemplateSlots(const std::string & rSide, std::vector<std::vector<std::string>> & slots)
+	{
+		slots.clear();
+
+		std::vector<std::string> slotTexts = Explode(rSide, ',');
+		slots.reserve(slotTexts.size());
+		for (auto & slotText : slotTexts)
+		{
+			std::vector<std::string> names = Explode(Trim(slotText), '|');
+			for (auto & name : names)
+				name = Trim(name);
+
+			slots.push_back(std::move(names));
+		}
+	}
+}
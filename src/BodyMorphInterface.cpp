@@ -19,13 +19,16 @@
 #include "Utilities.h"
 
 #include "common/IDirectoryIterator.h"
+#include "common/IFileStream.h"
 #include <set>
 
 #include <regex>
 #include <algorithm>
+#include <cmath>
 #include <ppl.h>
 #include <atomic>
 #include <chrono>
+#include <thread>
 
 extern BodyGenInterface g_bodyGenInterface;
 extern BodyMorphInterface g_bodyMorphInterface;
@@ -36,6 +39,10 @@ extern StringTable g_stringTable;
 extern bool g_bEnableBodyMorphs;
 extern bool g_bEnableOverlays;
 extern bool g_bParallelShapes;
+extern bool g_bEnableMorphCache;
+extern bool g_bQuantizeMorphs;
+extern float g_fMorphQuantizationError;
+extern float g_fMinMorphDisplacement;
 extern F4SETaskInterface * g_task;
 
 using namespace Serialization;
@@ -44,288 +51,710 @@ using namespace Serialization;
 //#define _DEBUG_FILEIO
 //#define _DEBUG_SERIALIZATION
 #define _DEBUG_MOPRHING
+//#define _DEBUG_DUMPMESH
 #endif
 
-bool TriShapeFullVertexData::ApplyMorph(UInt16 vertCount, NiPoint3 * vertices, float factor)
+SInt32 BodyMorphMap::ApplyMorphs(const float * weights, UInt32 vertCount, NiPoint3 * vertices, UInt8 * touched) const
 {
-	bool outOfBounds = false;
-	if (!vertices)
-		return outOfBounds;
+	if (!weights || !vertices)
+		return -1;
 
-	UInt32 size = m_vertexDeltas.size();
-	for (UInt32 i = 0; i < size; i++)
+	return m_matrix.Apply(weights, (Morpher::Vector3*)vertices, vertCount, touched);
+}
+
+std::shared_ptr<Morpher::MeshTopology> BodyMorphMap::GetTopology()
+{
+	SimpleLocker locker(&m_morphLock);
+	return m_topology;
+}
+
+bool BodyMorphMap::ReplaceTopology(const std::shared_ptr<Morpher::MeshTopology> & expected, const std::shared_ptr<Morpher::MeshTopology> & topology)
+{
+	SimpleLocker locker(&m_morphLock);
+	if(m_topology != expected)
+		return false;
+
+	m_topology = topology;
+	return true;
+}
+
+bool TriShapeMap::Load(const UInt8 * data, size_t size, float maxError)
+{
+	if (!m_arena.Parse(data, size))
+		return false;
+
+	BuildShapes(maxError);
+	return true;
+}
+
+bool TriShapeMap::LoadCached(const UInt8 * data, size_t size, const Morpher::TriArena::SourceKey & key, const std::shared_ptr<const void> & owner)
+{
+	if (!m_arena.Load(data, size, key, owner))
+		return false;
+
+	BuildShapes(-1.0f);
+	return true;
+}
+
+void TriShapeMap::ReleaseDeltas()
+{
+	m_arena.ReleaseDeltas();
+
+	// The arena moved into a new block
+	for (UInt32 i = 0; i < m_arena.GetShapeCount(); i++)
+		m_shapes[i].m_shape = &m_arena.GetShapes()[i];
+}
+
+void TriShapeMap::BuildShapes(float maxError)
+{
+	// The matrices are built from the quantized deltas, so they shrink with the arena
+	float error;
+	if (maxError >= 0.0f && !m_arena.IsPacked())
+		m_arena.Quantize(maxError, error);
+
+	std::vector<BodyMorphMap>(m_arena.GetShapeCount()).swap(m_shapes);
+	for (UInt32 i = 0; i < m_arena.GetShapeCount(); i++)
 	{
-		TriShapeVertexDelta * vert = &m_vertexDeltas.at(i);
-		UInt16 vertexIndex = vert->index;
-		NiPoint3 * vertexDiff = &vert->diff;
-		if (vertexIndex < vertCount)
+		m_shapes[i].m_arena = &m_arena;
+		m_shapes[i].m_shape = &m_arena.GetShapes()[i];
+		m_shapes[i].m_matrix.Build(m_arena, m_arena.GetShapes()[i]);
+
+		// Names are unique within a shape, so every id maps to at most one slot
+		const Morpher::TriArena::Shape & shape = m_arena.GetShapes()[i];
+		std::vector<UInt32> morphIds(shape.numMorphs);
+		UInt32 numSlots = 0;
+		for (UInt32 m = 0; m < shape.numMorphs; m++)
 		{
-			vertices[vertexIndex].x += vertexDiff->x * factor;
-			vertices[vertexIndex].y += vertexDiff->y * factor;
-			vertices[vertexIndex].z += vertexDiff->z * factor;
-		}
-		else if(!outOfBounds) { // Prevent spam
-			_WARNING("%s - Vertex (%d/%d) out of bounds X:%f Y:%f Z:%f", __FUNCTION__, vertexIndex, vertCount, vertexDiff->x, vertexDiff->y, vertexDiff->z);
-			outOfBounds = true;
+			const char * name = m_arena.GetName(m_arena.GetMorphs()[shape.firstMorph + m].name);
+			morphIds[m] = Morpher::GetMorphId(name, strlen(name));
+			numSlots = (std::max)(numSlots, morphIds[m] + 1);
 		}
+
+		m_shapes[i].m_slots.assign(numSlots, -1);
+		for (UInt32 m = 0; m < shape.numMorphs; m++)
+			m_shapes[i].m_slots[morphIds[m]] = (SInt32)m;
 	}
+}
 
-	return outOfBounds;
+// Allocated like GetObjectSize measures it, the counter itself is not needed
+TriShapeMapPtr TriShapeMap::Create()
+{
+	return std::allocate_shared<TriShapeMap>(Morpher::CountingAllocator<TriShapeMap>(nullptr));
 }
 
-bool TriShapePackedVertexData::ApplyMorph(UInt16 vertCount, NiPoint3 * vertices, float factor)
+size_t TriShapeMap::GetObjectSize()
 {
-	bool outOfBounds = false;
-	if (!vertices)
-		return outOfBounds;
+	// Allocated once the same way Create does it, the control block type and so its size are the same for every map
+	static size_t objectSize = []()
+	{
+		std::atomic<int64_t> allocated(0);
+		auto trishapeMap = std::allocate_shared<TriShapeMap>(Morpher::CountingAllocator<TriShapeMap>(&allocated));
+		return (size_t)allocated.load();
+	}();
+	return objectSize;
+}
 
-	UInt32 size = m_vertexDeltas.size();
-	for (UInt32 i = 0; i < size; i++)
+size_t TriShapeMap::GetMemoryUsage()
+{
+	size_t usage = GetObjectSize() + m_arena.GetMemoryUsage() + m_shapes.capacity() * sizeof(BodyMorphMap);
+	for (auto & shape : m_shapes)
 	{
-		TriShapePackedVertexDelta * vert = &m_vertexDeltas.at(i);
+		usage += shape.m_matrix.GetMemoryUsage() + shape.m_slots.capacity() * sizeof(SInt32);
 
-		UInt16 vertexIndex = vert->index;
-		float xDelta = (float)vert->x * m_multiplier;
-		float yDelta = (float)vert->y * m_multiplier;
-		float zDelta = (float)vert->z * m_multiplier;
-		if (vertexIndex < vertCount)
-		{
-			vertices[vertexIndex].x += xDelta * factor;
-			vertices[vertexIndex].y += yDelta * factor;
-			vertices[vertexIndex].z += zDelta * factor;
-		}
-		else if(!outOfBounds) { // Prevent spam
-			_WARNING("%s - Vertex (%d/%d) out of bounds X:%f Y:%f Z:%f", __FUNCTION__, vertexIndex, vertCount, xDelta, yDelta, zDelta);
-			outOfBounds = true;
-		}
+		auto topology = shape.GetTopology();
+		if (topology)
+			usage += topology->GetMemoryUsage();
 	}
-
-	return outOfBounds;
+	return usage;
 }
 
-TriShapeVertexDataPtr BodyMorphMap::GetVertexData(const F4EEFixedString & name)
+BodyMorphMapPtr TriShapeMap::GetMorphData(const F4EEFixedString & name)
 {
-	SimpleLocker locker(&m_morphLock);
-	auto it = find(name);
-	if(it != end()) {
-		return it->second;
+	auto shape = m_arena.FindShape(name.c_str(), strlen(name.c_str()), name.GetHash());
+	if(shape) {
+		return BodyMorphMapPtr(shared_from_this(), &m_shapes[shape - m_arena.GetShapes()]);
 	}
 
 	return nullptr;
 }
 
-BodyMorphMapPtr TriShapeMap::GetMorphData(const F4EEFixedString & name)
+// Parsed TRI files are saved here as arenas, mirroring the paths of their sources
+static const char * s_morphCachePath = "Data\\F4SE\\Plugins\\F4EE\\MorphCache\\";
+
+// Loose files are keyed by size and write time, so they are not read at all when the cache is current
+static bool GetLooseFileKey(const char * relativePath, Morpher::TriArena::SourceKey & key)
 {
-	SimpleLocker locker(&m_morphLock);
-	auto it = find(name);
-	if(it != end()) {
-		return it->second;
+	std::string path = std::string("Data\\") + relativePath;
+
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	key.size = ((UInt64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	key.time = ((UInt64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	key.hash = 0;
+	return true;
+}
+
+// Maps the cache file read only, the view is released with the last arena using it
+// Images quantized for another limit, or not quantized when they now would be, are ignored so the source is parsed again
+static bool LoadCachedTrishapeMap(const std::string & cachePath, const Morpher::TriArena::SourceKey & key, float maxError, TriShapeMap & trishapeMap)
+{
+	HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+
+	void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view)
+		return false;
+
+	std::shared_ptr<const void> owner(view, [](const void * view) { UnmapViewOfFile(view); });
+	if (!trishapeMap.LoadCached((const UInt8*)view, (size_t)fileSize.QuadPart, key, owner))
+	{
+#ifdef _DEBUG_FILEIO
+		_MESSAGE("%s - Ignoring cache: %s.\t[%s]", __FUNCTION__, trishapeMap.GetArena().GetError(), cachePath.c_str());
+#endif
+		return false;
 	}
 
-	return nullptr;
+	auto & arena = trishapeMap.GetArena();
+	bool current = true;
+	if (arena.IsQuantized())
+		current = maxError >= 0.0f && arena.GetQuantizationError() <= maxError;
+	else if (!arena.IsPacked())
+		current = maxError < 0.0f || arena.GetQuantizationError() > maxError;
+
+	if (!current)
+	{
+#ifdef _DEBUG_FILEIO
+		_MESSAGE("%s - Ignoring cache: quantized for another limit.\t[%s]", __FUNCTION__, cachePath.c_str());
+#endif
+		return false;
+	}
+
+	return true;
+}
+
+// Reports morphs that are likely broken, once when the file is parsed
+static void WarnTrishapeMap(const TriShapeMap & trishapeMap, const F4EEFixedString & filePath)
+{
+	auto & arena = trishapeMap.GetArena();
+	for (UInt32 i = 0; i < arena.GetShapeCount(); i++)
+	{
+		auto & shape = arena.GetShapes()[i];
+		const char * trishapeName = arena.GetName(shape.name);
+
+#ifdef _DEBUG_FILEIO
+		_MESSAGE("%s - Read TriShape %s with %d morphs", __FUNCTION__, trishapeName, shape.numMorphs);
+#endif
+
+		for (UInt32 j = 0; j < shape.numMorphs; j++)
+		{
+			auto & morph = arena.GetMorphs()[shape.firstMorph + j];
+			const char * morphName = arena.GetName(morph.name);
+			if (morphName[0] == 0) {
+				_WARNING("%s - Warning - Read empty name morph on %s.\t[%s]", __FUNCTION__, trishapeName, filePath.c_str());
+			}
+			if (morph.numDeltas == 0) {
+				_WARNING("%s - Error - Read morph %s on %s with no vertices.\t[%s]", __FUNCTION__, morphName, trishapeName, filePath.c_str());
+			}
+			if (arena.IsPacked() && morph.multiplier == 0.0f) {
+				_WARNING("%s - Error - Read morph %s on %s with zero multiplier.\t[%s]", __FUNCTION__, morphName, trishapeName, filePath.c_str());
+			}
+		}
+	}
+}
+
+// Written next to the target and moved over it, so a reader never sees half a file
+static void SaveCachedTrishapeMap(const std::string & cachePath, const Morpher::TriArena::SourceKey & key, const TriShapeMap & trishapeMap)
+{
+	std::vector<UInt8> image;
+	trishapeMap.GetArena().Save(key, image);
+	if (image.empty())
+		return;
+
+	std::string tempPath = cachePath + "." + std::to_string(GetCurrentThreadId()) + ".tmp";
+	IFileStream::MakeAllDirs(cachePath.c_str());
+	{
+		IFileStream file;
+		if (!file.Create(tempPath.c_str())) {
+			_WARNING("%s - Warning - Failed to create cache.\t[%s]", __FUNCTION__, tempPath.c_str());
+			return;
+		}
+		file.WriteBuf(image.data(), image.size());
+	}
+
+	if (!MoveFileExA(tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+		DeleteFileA(tempPath.c_str());
 }
 
 TriShapeMapPtr BodyMorphInterface::GetTrishapeMap(const char * relativePath)
 {
+	if (!relativePath || !relativePath[0])
+		return nullptr;
+
 	F4EEFixedString filePath(relativePath);
-	if(relativePath == "")
+	TriShapeMapPtr trishapeMap;
+	std::shared_future<TriShapeMapPtr> pending;
+	switch (m_morphCache.Acquire(filePath, trishapeMap, pending))
+	{
+	case Morpher::ShardedCache<F4EEFixedString, TriShapeMapPtr>::kFound:
+		break;
+	case Morpher::ShardedCache<F4EEFixedString, TriShapeMapPtr>::kPending:
+		// Already being loaded, wait for that instead of reading the file again
+		trishapeMap = pending.get();
+		break;
+	default:
+		return FinishTrishapeMap(filePath);
+	}
+
+	if (m_morphTrace.IsOpen())
+		m_morphTrace.Access(filePath.c_str(), trishapeMap ? trishapeMap->GetMemoryUsage() : 0);
+	return trishapeMap;
+}
+
+TriShapeMapPtr BodyMorphInterface::PrefetchTrishapeMap(const char * relativePath, bool * loading)
+{
+	if (loading)
+		*loading = false;
+
+	if (m_loaderThreads == 0)
+		return GetTrishapeMap(relativePath);
+
+	if (!relativePath || !relativePath[0])
 		return nullptr;
 
-	m_morphCacheLock.Lock();
-	auto & it = m_morphCache.find(filePath);
-	if (it != m_morphCache.end()) {
-		it->second->accessed = std::time(nullptr);
-		m_morphCacheLock.Release();
-		return it->second;
+	F4EEFixedString filePath(relativePath);
+	TriShapeMapPtr trishapeMap;
+	std::shared_future<TriShapeMapPtr> pending;
+	switch (m_morphCache.Acquire(filePath, trishapeMap, pending))
+	{
+	case Morpher::ShardedCache<F4EEFixedString, TriShapeMapPtr>::kFound:
+		if (m_morphTrace.IsOpen())
+			m_morphTrace.Access(filePath.c_str(), trishapeMap ? trishapeMap->GetMemoryUsage() : 0);
+		break;
+	case Morpher::ShardedCache<F4EEFixedString, TriShapeMapPtr>::kLoad:
+		{
+			std::lock_guard<std::mutex> queueLocker(m_loadQueueLock);
+			m_loadQueue.push_back(filePath);
+		}
+		m_loadQueueSignal.notify_one();
+		if (loading)
+			*loading = true;
+		break;
+	default:
+		if (loading)
+			*loading = true;
+		break;
 	}
-	m_morphCacheLock.Release();
 
-#ifdef _DEBUG_FILEIO
-	_MESSAGE("%s - Parsing: %s", __FUNCTION__, filePath.c_str());
-#endif
+	return trishapeMap;
+}
 
-	BSResourceNiBinaryStream binaryStream(filePath);
-	if(binaryStream.IsValid())
+void BodyMorphInterface::StartLoaders(UInt32 count)
+{
+	// The loaders live as long as the game does, they are never joined
+	for (; m_loaderThreads < count; m_loaderThreads++)
+		std::thread(&BodyMorphInterface::RunLoader, this).detach();
+}
+
+void BodyMorphInterface::RunLoader()
+{
+	for (;;)
 	{
-		TriShapeMapPtr trishapeMap = std::make_shared<TriShapeMap>();
+		F4EEFixedString filePath;
+		{
+			std::unique_lock<std::mutex> queueLocker(m_loadQueueLock);
+			m_loadQueueSignal.wait(queueLocker, [&]() { return !m_loadQueue.empty(); });
+			filePath = std::move(m_loadQueue.front());
+			m_loadQueue.pop_front();
+		}
 
-		UInt32 fileFormat = 0;
-		trishapeMap->memoryUsage += binaryStream.Read((char *)&fileFormat, sizeof(UInt32));
+		// Nothing above this thread would catch it, so a failed load must not end it
+		try
+		{
+			FinishTrishapeMap(filePath);
+		}
+		catch(const std::exception & e)
+		{
+			_ERROR("%s - Error - Failed to load %s: %s", __FUNCTION__, filePath.c_str(), e.what());
+		}
+		catch(...)
+		{
+			_ERROR("%s - Error - Failed to load %s", __FUNCTION__, filePath.c_str());
+		}
+	}
+}
 
-		bool packed = false;
-		if (fileFormat != 'TRI\0' && fileFormat != 'TRIP')
-			return nullptr;
+// Loads the file for a caller that was told to by the cache, then hands it to everyone waiting
+TriShapeMapPtr BodyMorphInterface::FinishTrishapeMap(const F4EEFixedString & filePath)
+{
+	auto start = std::chrono::steady_clock::now();
+	TriShapeMapPtr trishapeMap;
+	try
+	{
+		trishapeMap = LoadTrishapeMap(filePath);
+	}
+	catch(...)
+	{
+		// Out of memory, release whoever waits for this file before passing it on, nothing is cached so it is loaded again next time
+		m_morphCache.Fail(filePath);
+		m_loadFailures++;
+		throw;
+	}
+	m_loadTimes.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
 
-		if (fileFormat == 'TRIP')
-			packed = true;
+	size_t memoryUsage = trishapeMap ? trishapeMap->GetMemoryUsage() : 0;
+	m_morphCache.Complete(filePath, trishapeMap, memoryUsage);
 
-		UInt32 trishapeCount = 0;
-		if (!packed)
-			trishapeMap->memoryUsage += binaryStream.Read((char *)&trishapeCount, sizeof(UInt32));
-		else
-			trishapeMap->memoryUsage += binaryStream.Read((char *)&trishapeCount, sizeof(UInt16));
+	if (trishapeMap) {
+		m_loads++;
+		m_bytesLoaded += memoryUsage;
+	}
+	else
+		m_loadFailures++;
 
-		char trishapeNameRaw[MAX_PATH];
-		for (UInt32 i = 0; i < trishapeCount; i++)
-		{
-			memset(trishapeNameRaw, 0, MAX_PATH);
+	if (m_morphTrace.IsOpen())
+		m_morphTrace.Access(filePath.c_str(), memoryUsage);
 
-			UInt8 size = 0;
-			trishapeMap->memoryUsage += binaryStream.Read((char *)&size, sizeof(UInt8));
-			trishapeMap->memoryUsage += binaryStream.Read(trishapeNameRaw, size);
-			F4EEFixedString trishapeName(trishapeNameRaw);
+	if (trishapeMap)
+		_VMESSAGE("%s - Info - Loaded %s (%s) (Cache: %s / %s)", __FUNCTION__, filePath.c_str(), bytes_to_string(memoryUsage).c_str(), bytes_to_string(m_morphCache.GetResident()).c_str(), bytes_to_string(m_morphCache.GetLimit()).c_str());
+	return trishapeMap;
+}
 
+TriShapeMapPtr BodyMorphInterface::LoadTrishapeMap(const F4EEFixedString & filePath)
+{
 #ifdef _DEBUG_FILEIO
-			_MESSAGE("%s - Reading TriShape %s", __FUNCTION__, trishapeName.c_str());
+	_MESSAGE("%s - Parsing: %s", __FUNCTION__, filePath.c_str());
 #endif
 
-			if (!packed) {
-				UInt32 trishapeBlockSize = 0;
-				trishapeMap->memoryUsage += binaryStream.Read((char *)&trishapeBlockSize, sizeof(UInt32));
-			}
+	Morpher::TriArena::SourceKey sourceKey;
+	std::string cachePath;
+	bool looseSource = false;
+	if (g_bEnableMorphCache) {
+		cachePath = std::string(s_morphCachePath) + filePath.c_str() + ".f4eemorph";
+		looseSource = GetLooseFileKey(filePath.c_str(), sourceKey);
+	}
+
+	float maxError = g_bQuantizeMorphs ? g_fMorphQuantizationError : -1.0f;
 
-			char morphNameRaw[MAX_PATH];
+	TriShapeMapPtr trishapeMap = TriShapeMap::Create();
+	bool cached = looseSource && LoadCachedTrishapeMap(cachePath, sourceKey, maxError, *trishapeMap);
+	if (!cached)
+	{
+		BSResourceNiBinaryStream binaryStream(filePath);
+		if(!binaryStream.IsValid())
+		{
+			_ERROR("%s - Error - Failed to load.\t[%s]", __FUNCTION__, filePath.c_str());
+			return nullptr;
+		}
 
-			BodyMorphMapPtr morphMap = std::make_shared<BodyMorphMap>();
+		// One read for the whole file, the fields are then parsed from memory
+		std::vector<UInt8> fileData;
+		BSReadAll(&binaryStream, &fileData);
 
-			UInt32 morphCount = 0;
-			if (!packed)
-				trishapeMap->memoryUsage += binaryStream.Read((char *)&morphCount, sizeof(UInt32));
-			else
-				trishapeMap->memoryUsage += binaryStream.Read((char *)&morphCount, sizeof(UInt16));
+		// Archived files have no time to go by, their content decides whether the cache is current
+		if (g_bEnableMorphCache && !looseSource) {
+			sourceKey.size = fileData.size();
+			sourceKey.hash = Morpher::TriArena::HashSource(fileData.data(), fileData.size());
+			cached = LoadCachedTrishapeMap(cachePath, sourceKey, maxError, *trishapeMap);
+		}
 
-			for (UInt32 j = 0; j < morphCount; j++)
+		if (!cached)
+		{
+			auto & arena = trishapeMap->GetArena();
+			if(!trishapeMap->Load(fileData.data(), fileData.size(), maxError))
 			{
-				memset(morphNameRaw, 0, MAX_PATH);
+				_ERROR("%s - Error - %s.\t(%08X) [%s]", __FUNCTION__, arena.GetError(), (UInt32)arena.GetErrorOffset(), filePath.c_str());
+				return nullptr;
+			}
 
-				UInt8 tsize = 0;
-				trishapeMap->memoryUsage += binaryStream.Read((char *)&tsize, sizeof(UInt8));
-				trishapeMap->memoryUsage += binaryStream.Read(morphNameRaw, tsize);
-				F4EEFixedString morphName(morphNameRaw);
+			WarnTrishapeMap(*trishapeMap, filePath);
 
-#ifdef _DEBUG_FILEIO
-				_MESSAGE("%s - Reading Morph %s at (%08X)", __FUNCTION__, morphName.c_str(), binaryStream.GetOffset());
-#endif
-				if (tsize == 0) {
-					_WARNING("%s - Warning - Read empty name morph.\t(%08X) [%s]", __FUNCTION__, binaryStream.GetOffset(), filePath.c_str());
-				}
+			if (arena.IsQuantized()) {
+				_VMESSAGE("%s - Info - Quantized morphs, largest error %f.\t[%s]", __FUNCTION__, arena.GetQuantizationError(), filePath.c_str());
+			}
+			else if (maxError >= 0.0f && !arena.IsPacked()) {
+				_WARNING("%s - Warning - Quantizing morphs would introduce an error of %f, over the limit of %f, kept full precision.\t[%s]", __FUNCTION__, arena.GetQuantizationError(), maxError, filePath.c_str());
+			}
 
-				if (!packed) {
-					UInt32 morphBlockSize = 0;
-					trishapeMap->memoryUsage += binaryStream.Read((char *)&morphBlockSize, sizeof(UInt32));
-				}
+			if (g_bEnableMorphCache)
+				SaveCachedTrishapeMap(cachePath, sourceKey, *trishapeMap);
+		}
+	}
 
-				UInt32 vertexNum = 0;
-				float multiplier = 0.0f;
-				if(!packed) {
-					trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexNum, sizeof(UInt32));
-				}
-				else {
-					trishapeMap->memoryUsage += binaryStream.Read((char *)&multiplier, sizeof(float));
-					trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexNum, sizeof(UInt16));
-				}
+	trishapeMap->ReleaseDeltas();
+	return trishapeMap;
+}
 
-				if (vertexNum == 0) {
-					_WARNING("%s - Error - Read morph %s on %s with no vertices.\t(%08X) [%s]", __FUNCTION__, morphName.c_str(), trishapeName.c_str(), binaryStream.GetOffset(), filePath.c_str());
-				}
-				if (multiplier == 0.0f) {
-					_WARNING("%s - Error - Read morph %s on %s with zero multiplier.\t(%08X) [%s]", __FUNCTION__, morphName.c_str(), trishapeName.c_str(), binaryStream.GetOffset(), filePath.c_str());
-				}
+void BodyMorphInterface::ShrinkMorphCache()
+{
+	// Runs for every model and every morphed shape, with the maintenance thread running all it does is check the sizes
+	if (m_maintenanceRunning) {
+		if ((m_morphCache.IsOverLimit() || m_geometryCache.IsOverLimit()) && !m_maintenanceWake.exchange(true)) {
+			std::lock_guard<std::mutex> locker(m_maintenanceLock);
+			m_maintenanceSignal.notify_one();
+		}
+		return;
+	}
 
-#ifdef _DEBUG_FILEIO
-				_MESSAGE("%s - Total Vertices read: %d at (%08X)", __FUNCTION__, vertexNum, binaryStream.GetOffset());
-#endif
-				if (vertexNum > (std::numeric_limits<UInt16>::max)())
-				{
-					_ERROR("%s - Error - Too many vertices for %s on %s read: %d.\t(%08X) [%s]", __FUNCTION__, morphName.c_str(), vertexNum, trishapeName.c_str(), binaryStream.GetOffset(), filePath.c_str());
-					return nullptr;
-				}
+	m_morphCache.Shrink();
+	m_geometryCache.Shrink();
+	LogCacheStatsIfDue();
+	RetryFailedLoadsIfDue();
+}
 
-				TriShapeVertexDataPtr vertexData;
-				TriShapeFullVertexDataPtr fullVertexData;
-				TriShapePackedVertexDataPtr packedVertexData;
-				if (!packed)
-				{
-					fullVertexData = std::make_shared<TriShapeFullVertexData>();
-					for (UInt32 k = 0; k < vertexNum; k++)
-					{
-						TriShapeVertexDelta vertexDelta;
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.index, sizeof(UInt32));
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.diff, sizeof(NiPoint3));
-						fullVertexData->m_vertexDeltas.push_back(vertexDelta);
-					}
+void BodyMorphInterface::StartMaintenance(float lowWater, UInt32 idleMinutes)
+{
+	if (m_maintenanceRunning)
+		return;
 
-					vertexData = fullVertexData;
-				}
-				else
-				{
-					packedVertexData = std::make_shared<TriShapePackedVertexData>();
-					packedVertexData->m_multiplier = multiplier;
+	m_lowWater = (std::max)(0.0f, (std::min)(1.0f, lowWater));
+	m_idleMinutes = idleMinutes;
+	m_maintenanceRunning = true;
 
-					for (UInt32 k = 0; k < vertexNum; k++)
-					{
-						TriShapePackedVertexDelta vertexDelta;
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.index, sizeof(UInt16));
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.x, sizeof(SInt16));
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.y, sizeof(SInt16));
-						trishapeMap->memoryUsage += binaryStream.Read((char *)&vertexDelta.z, sizeof(SInt16));
+	// Lives as long as the game does, like the loaders
+	std::thread(&BodyMorphInterface::RunMaintenance, this).detach();
+}
 
-						packedVertexData->m_vertexDeltas.push_back(vertexDelta);
-					}
+void BodyMorphInterface::RunMaintenance()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
 
-					vertexData = packedVertexData;
-				}
+	// The caches count uses rather than time, so their clocks are read every pass to tell how long ago a use was
+	struct ClockReading
+	{
+		UInt64	time;
+		UInt64	morphClock;
+		UInt64	geometryClock;
+	};
+	std::deque<ClockReading> readings;
 
-				morphMap->emplace(morphName, vertexData);
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> locker(m_maintenanceLock);
+			m_maintenanceSignal.wait_for(locker, std::chrono::seconds(30), [&]() { return m_maintenanceWake.load(); });
+		}
+		m_maintenanceWake = false;
+
+		if (m_morphCache.IsOverLimit())
+			m_morphCache.Shrink((UInt64)(m_morphCache.GetLimit() * (double)m_lowWater));
+		if (m_geometryCache.IsOverLimit())
+			m_geometryCache.Shrink((UInt64)(m_geometryCache.GetLimit() * (double)m_lowWater));
+
+		if (m_idleMinutes) {
+			UInt64 now = GetTickCount64() / 1000;
+			readings.push_back({ now, m_morphCache.GetClock(), m_geometryCache.GetClock() });
+
+			// The newest reading at least the idle time old, anything not used since then has been idle that long
+			UInt64 idle = (UInt64)m_idleMinutes * 60;
+			while (readings.size() > 1 && now - readings[1].time >= idle)
+				readings.pop_front();
+
+			if (now - readings.front().time >= idle) {
+				UInt64 expired = m_morphCache.Expire(readings.front().morphClock);
+				expired += m_geometryCache.Expire(readings.front().geometryClock);
+				if (expired)
+					_VMESSAGE("%s - Info - Expired %llu cache entries idle for %u minutes", __FUNCTION__, expired, m_idleMinutes);
 			}
-
-			trishapeMap->emplace(trishapeName, morphMap);
-			
 		}
 
-		trishapeMap->accessed = std::time(nullptr);
+		LogCacheStatsIfDue();
+		RetryFailedLoadsIfDue();
+	}
+}
 
-		m_morphCacheLock.Lock();
-		m_morphCache.emplace(relativePath, trishapeMap);
-		m_morphCacheLock.Release();
+void BodyMorphInterface::LogCacheStatsIfDue()
+{
+	if (m_statsInterval) {
+		UInt64 now = GetTickCount64() / 1000;
+		UInt64 last = m_lastStatsLog;
+		if (last == 0)
+			m_lastStatsLog.compare_exchange_strong(last, now);
+		else if (now - last >= m_statsInterval && m_lastStatsLog.compare_exchange_strong(last, now))
+			LogCacheStats();
+	}
+}
 
-		m_totalMemory += trishapeMap->memoryUsage;
+// Files can be fixed or installed while the game runs, so a failure is only remembered for a while
+void BodyMorphInterface::RetryFailedLoadsIfDue()
+{
+	static const UInt64 retrySeconds = 60;
+
+	UInt64 now = GetTickCount64() / 1000;
+	UInt64 last = m_lastFailureRetry;
+	if (last == 0)
+		m_lastFailureRetry.compare_exchange_strong(last, now);
+	else if (now - last >= retrySeconds && m_lastFailureRetry.compare_exchange_strong(last, now)) {
+		UInt64 expired = m_morphCache.ExpireEmpty();
+		if (expired)
+			_VMESSAGE("%s - Info - Retrying %llu files that failed to load", __FUNCTION__, expired);
+	}
+}
 
-		_VMESSAGE("%s - Info - Loaded %s (%s) (Cache: %s / %s)", __FUNCTION__, relativePath, bytes_to_string(trishapeMap->memoryUsage).c_str(), bytes_to_string(m_totalMemory).c_str(), bytes_to_string(m_memoryLimit).c_str());
-		return trishapeMap;
+void BodyMorphInterface::GetCacheStats(MorphCacheStats & stats, UInt32 largest)
+{
+	stats.count = m_morphCache.GetCount();
+	stats.resident = m_morphCache.GetResident();
+	stats.overhead = m_morphCache.GetOverhead();
+	stats.limit = m_morphCache.GetLimit();
+	stats.hits = m_morphCache.GetHits();
+	stats.misses = m_morphCache.GetMisses();
+	stats.loads = m_loads;
+	stats.failures = m_loadFailures;
+	stats.evictions = m_morphCache.GetEvictions();
+	stats.expirations = m_morphCache.GetExpirations();
+	stats.bytesLoaded = m_bytesLoaded;
+
+	const double percentiles[3] = { 0.5, 0.9, 0.99 };
+	for (UInt32 i = 0; i < 3; i++)
+		stats.loadTime[i] = m_loadTimes.GetPercentile(percentiles[i]) / 1000.0;
+
+	stats.largest.clear();
+	m_morphCache.ForEach([&](const F4EEFixedString & filePath, const TriShapeMapPtr & trishapeMap, UInt64 size)
+	{
+		if (trishapeMap)
+			stats.largest.emplace_back(filePath.c_str(), size);
+	});
+
+	auto bySize = [](const std::pair<std::string, UInt64> & a, const std::pair<std::string, UInt64> & b) { return a.second > b.second; };
+	if (stats.largest.size() > largest) {
+		std::partial_sort(stats.largest.begin(), stats.largest.begin() + largest, stats.largest.end(), bySize);
+		stats.largest.resize(largest);
 	}
 	else
+		std::sort(stats.largest.begin(), stats.largest.end(), bySize);
+
+	stats.geometryCount = m_geometryCache.GetCount();
+	stats.geometryResident = m_geometryCache.GetResident();
+	stats.geometryLimit = m_geometryCache.GetLimit();
+	stats.geometryHits = m_geometryCache.GetHits();
+	stats.geometryMisses = m_geometryCache.GetMisses();
+}
+
+void BodyMorphInterface::FormatCacheStats(std::vector<std::string> & lines, UInt32 largest)
+{
+	MorphCacheStats stats;
+	GetCacheStats(stats, largest);
+
+	char buffer[MAX_PATH + 64];
+	UInt64 lookups = stats.hits + stats.misses;
+	sprintf_s(buffer, "Files: %llu", stats.count);
+	lines.push_back(buffer);
+	sprintf_s(buffer, "Resident: %s of %s (%s cache overhead)", bytes_to_string(stats.resident).c_str(), bytes_to_string(stats.limit).c_str(), bytes_to_string(stats.overhead).c_str());
+	lines.push_back(buffer);
+	sprintf_s(buffer, "Hits: %llu, Misses: %llu (%.1f%% hit rate)", stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0);
+	lines.push_back(buffer);
+	sprintf_s(buffer, "Loads: %llu, Failed: %llu, Evictions: %llu, Expired: %llu, Loaded: %s", stats.loads, stats.failures, stats.evictions, stats.expirations, bytes_to_string(stats.bytesLoaded).c_str());
+	lines.push_back(buffer);
+	sprintf_s(buffer, "Load time: %.2f ms median, %.2f ms 90th, %.2f ms 99th", stats.loadTime[0], stats.loadTime[1], stats.loadTime[2]);
+	lines.push_back(buffer);
+	for (auto & entry : stats.largest)
 	{
-		_ERROR("%s - Error - Failed to load.\t[%s]", __FUNCTION__, relativePath);
+		sprintf_s(buffer, "Largest: %s %.*s", bytes_to_string(entry.second).c_str(), MAX_PATH, entry.first.c_str());
+		lines.push_back(buffer);
 	}
+	UInt64 geometryLookups = stats.geometryHits + stats.geometryMisses;
+	sprintf_s(buffer, "Shared geometry: %llu blocks, %s of %s, %.1f%% of %llu shapes shared", stats.geometryCount, bytes_to_string(stats.geometryResident).c_str(), bytes_to_string(stats.geometryLimit).c_str(), geometryLookups ? 100.0 * stats.geometryHits / geometryLookups : 0.0, geometryLookups);
+	lines.push_back(buffer);
+}
 
+void BodyMorphInterface::LogCacheStats()
+{
+	std::vector<std::string> lines;
+	FormatCacheStats(lines);
 
-	return nullptr;
+	_MESSAGE("Morph cache stats:");
+	for (auto & line : lines)
+		_MESSAGE("\t%s", line.c_str());
 }
 
-void BodyMorphInterface::ShrinkMorphCache()
+void BodyMorphInterface::SetCacheLimit(UInt64 limit)
 {
-	m_morphCacheLock.Lock();
-	while (m_totalMemory > m_memoryLimit && m_morphCache.size() > 0)
-	{
-		auto & it = std::min_element(m_morphCache.begin(), m_morphCache.end(), [](std::pair<F4EEFixedString, TriShapeMapPtr> a, std::pair<F4EEFixedString, TriShapeMapPtr> b)
-		{
-			return (a.second->accessed < b.second->accessed);
-		});
+	m_morphCache.SetLimit(limit);
+}
+
+void BodyMorphInterface::SetCachePolicy(Morpher::CachePolicy policy)
+{
+	m_morphCache.SetPolicy(policy);
+}
+
+void BodyMorphInterface::SetGeometryCacheLimit(UInt64 limit)
+{
+	m_geometryCache.SetLimit(limit);
+	if (limit == 0)
+		m_geometryCache.Clear();
+}
 
-		UInt32 size = it->second->memoryUsage;
-		m_morphCache.erase(it);
-		m_totalMemory -= size;
+bool BodyMorphInterface::StartCacheTrace(const char * path)
+{
+	IFileStream::MakeAllDirs(path);
+	if (!m_morphTrace.Open(path)) {
+		_WARNING("%s - Warning - Failed to open cache trace.\t[%s]", __FUNCTION__, path);
+		return false;
 	}
+	return true;
+}
 
-	if (m_morphCache.size() == 0) // Just in case we erased but messed up
-		m_totalMemory = sizeof(std::unordered_map<F4EEFixedString, TriShapeMapPtr>);
-	m_morphCacheLock.Release();
+void BodyMorphInterface::PinTrishapeMap(const F4EEFixedString & filePath, bool pin)
+{
+	if (m_morphCache.Pin(filePath, pin) && m_morphTrace.IsOpen())
+		m_morphTrace.Pin(filePath.c_str(), pin);
 }
 
-void BodyMorphInterface::SetCacheLimit(UInt64 limit)
+void BodyMorphInterface::UpdatePlayerPins(Actor * actor, NiAVObject * slotNode)
 {
-	m_memoryLimit = limit;
+	std::unordered_set<F4EEFixedString> filePaths;
+	auto addShapes = [&](NiAVObject * node)
+	{
+		std::vector<MorphableShapePtr> shapes;
+		GetMorphableShapes(node, shapes);
+		for (auto & shape : shapes)
+			filePaths.insert(shape->morphPath);
+	};
+
+	// The node being installed may not be in its slot yet
+	if (slotNode)
+		addShapes(slotNode);
+
+	ActorEquipData * equipData[2];
+	equipData[0] = actor->equipData;
+	equipData[1] = (*g_player)->playerEquipData;
+	for (UInt32 s = 0; s < 2; s++)
+	{
+		if (!equipData[s])
+			continue;
+
+		for (UInt32 i = 0; i < 32; ++i)
+		{
+			NiPointer<NiAVObject> node(equipData[s]->slots[i].node);
+			if (node)
+				addShapes(node);
+		}
+	}
+
+	std::lock_guard<std::mutex> locker(m_pinLock);
+	for (auto & filePath : m_playerPins)
+	{
+		if (filePaths.find(filePath) == filePaths.end())
+			PinTrishapeMap(filePath, false);
+	}
+	for (auto & filePath : filePaths)
+	{
+		if (m_playerPins.find(filePath) == m_playerPins.end())
+			PinTrishapeMap(filePath);
+	}
+	m_playerPins.swap(filePaths);
 }
 
 void BodyMorphInterface::LoadBodyGenSliderMods()
@@ -430,25 +859,40 @@ bool BodySlider::Parse(const Json::Value & entry)
 	return true;
 }
 
-bool BodyMorphInterface::IsNodeMorphable(NiAVObject * rootNode)
+bool BodyMorphInterface::GetMorphTags(BSTriShape * trishape, F4EEFixedString & morphPath, F4EEFixedString & shapeName)
 {
-	return VisitObjects(rootNode, [&](NiAVObject * node)
-	{
-		BSTriShape * trishape = node->GetAsBSTriShape();
-		if(trishape)
-		{
-			NiPointer<NiStringExtraData> bodyMorph(DYNAMIC_CAST(trishape->GetExtraData("MORPH_SHAPE"), NiExtraData, NiStringExtraData));
-			if(!bodyMorph)
-				return false;
+	NiPointer<NiStringExtraData> morphFile(DYNAMIC_CAST(trishape->GetExtraData("MORPH_FILE"), NiExtraData, NiStringExtraData));
+	if(!morphFile)
+		return false;
 
-			NiPointer<NiStringExtraData> morphPath(DYNAMIC_CAST(trishape->GetExtraData("MORPH_FILE"), NiExtraData, NiStringExtraData));
-			if(!morphPath)
-				return false;
+	NiPointer<NiStringExtraData> morphShape(DYNAMIC_CAST(trishape->GetExtraData("MORPH_SHAPE"), NiExtraData, NiStringExtraData));
+	if(morphShape) {
+		morphPath = morphFile->m_string;
+		shapeName = morphShape->m_string;
+		return true;
+	}
 
-			return true;
-		}
+	// Tagged while its file was still loading, so it only counts once the file turns out to have a shape by its name
+	const char * name = trishape->m_name.c_str();
+	if(!name || !name[0])
+		return false;
 
+	auto trishapeMap = GetTrishapeMap(morphFile->m_string.c_str());
+	if(!trishapeMap || !trishapeMap->GetMorphData(name))
 		return false;
+
+	morphPath = morphFile->m_string;
+	shapeName = name;
+	return true;
+}
+
+bool BodyMorphInterface::IsNodeMorphable(NiAVObject * rootNode)
+{
+	return VisitObjects(rootNode, [&](NiAVObject * node)
+	{
+		BSTriShape * trishape = node->GetAsBSTriShape();
+		F4EEFixedString morphPath, shapeName;
+		return trishape && GetMorphTags(trishape, morphPath, shapeName);
 	});
 }
 
@@ -457,18 +901,9 @@ void BodyMorphInterface::GetMorphableShapes(NiAVObject * rootNode, std::vector<M
 	VisitObjects(rootNode, [&](NiAVObject * node)
 	{
 		BSTriShape * trishape = node->GetAsBSTriShape();
-		if(trishape)
-		{
-			NiPointer<NiStringExtraData> bodyMorph(DYNAMIC_CAST(trishape->GetExtraData("MORPH_SHAPE"), NiExtraData, NiStringExtraData));
-			if(!bodyMorph)
-				return false;
-
-			NiPointer<NiStringExtraData> morphPath(DYNAMIC_CAST(trishape->GetExtraData("MORPH_FILE"), NiExtraData, NiStringExtraData));
-			if(!morphPath)
-				return false;
-
-			shapes.push_back(std::make_shared<MorphableShape>(trishape, morphPath->m_string, bodyMorph->m_string));
-		}
+		F4EEFixedString morphPath, shapeName;
+		if(trishape && GetMorphTags(trishape, morphPath, shapeName))
+			shapes.push_back(std::make_shared<MorphableShape>(trishape, morphPath, shapeName));
 		return false;
 	});
 }
@@ -539,6 +974,67 @@ void F4EEBodyGenUpdate::Run()
 #include "f4se/BSGraphics.h"
 #include "Morpher.h"
 
+// Describes a shape's geometry for the engine, vertexBlock is the block it reads and the triangles come from geomData
+static Morpher::GeometryView GetGeometryView(BSTriShape * geometry, BSGeometryData * geomData, UInt8 * vertexBlock)
+{
+	UInt64 vertexDesc = geometry->vertexDesc;
+
+	Morpher::GeometryView view;
+	view.layout.stride = geometry->GetVertexSize();
+	view.layout.fullPrecision = (vertexDesc & BSGeometry::kFlag_FullPrecision) != 0;
+	view.layout.hasUVs = (vertexDesc & BSGeometry::kFlag_UVs) != 0;
+	view.layout.hasNormals = (vertexDesc & BSGeometry::kFlag_Normals) != 0;
+	view.layout.hasTangents = view.layout.hasNormals && (vertexDesc & BSGeometry::kFlag_Tangents) != 0;
+	view.vertexBlock = vertexBlock;
+	view.numVertices = geometry->numVertices;
+	if(geomData->triangleData) {
+		view.triangles = (Morpher::Triangle*)geomData->triangleData->triangles;
+		view.numTriangles = geometry->numTriangles;
+	}
+	return view;
+}
+
+// The topology member stands in for the caller's, nothing is kept between calls here
+MorphApplicator::MorphApplicator(BSTriShape * _geometry, uint8_t * srcBlock, uint8_t * dstBlock, std::function<void(std::vector<Morpher::Vector3> &)> morph)
+	: MorphApplicator(GetGeometryView(_geometry, _geometry->geometryData, srcBlock ? srcBlock : _geometry->geometryData->vertexData->vertexBlock),
+		dstBlock ? dstBlock : _geometry->geometryData->vertexData->vertexBlock, topology)
+{
+	// The callback does not say what it moved, so it is compared against the base positions
+	std::vector<Morpher::Vector3> basePositions(rawVertices);
+	morph(rawVertices);
+	for(UInt32 i = 0; i < rawVertices.size(); i++)
+	{
+		if(rawVertices[i].x != basePositions[i].x || rawVertices[i].y != basePositions[i].y || rawVertices[i].z != basePositions[i].z)
+			touched[i] = 1;
+	}
+	Apply();
+}
+
+#ifdef _DEBUG_DUMPMESH
+#include "MeshDump.h"
+#include "common/IFileStream.h"
+
+// Writes the unmorphed geometry so it can be replayed with the standalone morph tool
+static void DumpMesh(const F4EEFixedString & shapeName, const Morpher::GeometryView & view)
+{
+	Morpher::MeshDump dump;
+	dump.Assign(view);
+
+	std::vector<UInt8> bytes;
+	dump.Serialize(bytes);
+
+	std::string filePath = std::string("Data\\F4SE\\Plugins\\F4EE\\MeshDumps\\") + shapeName.c_str() + ".mesh";
+	IFileStream currentFile;
+	IFileStream::MakeAllDirs(filePath.c_str());
+	if(!currentFile.Create(filePath.c_str())) {
+		_ERROR("%s - Error - Failed to create dump.\t[%s]", __FUNCTION__, filePath.c_str());
+		return;
+	}
+
+	currentFile.WriteBuf(bytes.data(), bytes.size());
+}
+#endif
+
 bool BodyMorphInterface::ApplyMorphsToShape(Actor * actor, const MorphableShapePtr & morphableShape)
 {
 	// Don't allow dynamic shapes
@@ -574,6 +1070,34 @@ bool BodyMorphInterface::ApplyMorphsToShape(Actor * actor, const MorphableShapeP
 		if(!actorMorphs) // There's nothing to morph, lets just use the base mesh
 			return false;
 
+		// Resolve the actor's morphs into a weight per morph of the shape up front, so no lock is held while the vertices are processed
+		// The actor's map has its own lock for every change, ids make each morph an array read instead of a name lookup
+		std::vector<float> weights(morphMap->GetMorphCount(), 0.0f);
+		bool anyWeight = false;
+		actorMorphs->Lock();
+		for(auto & actorMorph : *actorMorphs)
+		{
+			SInt32 slot = morphMap->GetMorphSlot(actorMorph.second->GetMorphId());
+			if(slot < 0)
+				continue;
+
+			float effectiveValue = actorMorph.second->GetEffectiveValue();
+			if(effectiveValue == 0.0f)
+				continue;
+
+			// Moves nothing by more than the threshold, leaving it out can spare the whole rebuild
+			if(std::fabs(effectiveValue) * morphMap->GetMaxDisplacement(slot) < g_fMinMorphDisplacement)
+				continue;
+
+			weights[slot] = effectiveValue;
+			anyWeight = true;
+		}
+		actorMorphs->Unlock();
+
+		// Nothing moves far enough to be seen, keep the base mesh and its normals
+		if(!anyWeight)
+			return false;
+
 		UInt64 vertexDesc = geometry->vertexDesc;
 		UInt32 vertexSize = geometry->GetVertexSize();
 		UInt32 blockSize = geometry->numVertices * vertexSize;
@@ -603,28 +1127,73 @@ bool BodyMorphInterface::ApplyMorphsToShape(Actor * actor, const MorphableShapeP
 
 		newBlock = geomData->vertexData->vertexBlock;
 
-		MorphApplicator morpher(geometry, newBlock, newBlock, [&](std::vector<Morpher::Vector3> & verts)
-		{
-			SimpleLocker locker(&m_morphLock);
+		// The same base mesh with the same morph values comes out the same, so only the first actor runs the pipeline and the rest copy its vertices
+		Morpher::GeometryKey geometryKey;
+		Morpher::GeometryBlockPtr sharedBlock;
+		bool shareGeometry = false;
+		if(m_geometryCache.GetLimit() > 0) {
+			UInt64 baseHash = Morpher::TriArena::HashSource(vertexData->vertexBlock, blockSize);
+			geometryKey = Morpher::GeometryKey(morphableShape->morphPath, morphableShape->shapeName, vertexDesc, geometry->numVertices, baseHash, weights.data(), (UInt32)weights.size());
 
-			actorMorphs->Lock();
-			for(auto & actorMorph : *actorMorphs)
+			std::shared_future<Morpher::GeometryBlockPtr> pending;
+			switch(m_geometryCache.Acquire(geometryKey, sharedBlock, pending))
 			{
-				float effectiveValue = actorMorph.second->GetEffectiveValue();
-				if(effectiveValue == 0.0f)
-					continue;
+			case Morpher::GeometryCache::kFound:
+				break;
+			case Morpher::GeometryCache::kPending:
+				// Never wait for it, under ppl this thread may be the one running the shape that completes it
+				// Unless it is already done this morphs on its own and leaves the cache to the owner
+				if(pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+					sharedBlock = pending.get();
+				break;
+			default:
+				shareGeometry = true;
+				break;
+			}
+		}
 
-				auto morph = morphMap->GetVertexData(*actorMorph.first);
-				if(!morph)
-					continue;
+		if(sharedBlock && sharedBlock->size() == blockSize) {
+			memcpy(newBlock, sharedBlock->data(), blockSize);
 
-				bool outOfBounds = morph->ApplyMorph(geometry->numVertices, (NiPoint3*)&verts.at(0), effectiveValue);
-				if(outOfBounds) {
-					_WARNING("%s - Shape: %s Morph: %s contained out of bounds vertices\t[%s]", __FUNCTION__, morphableShape->shapeName.c_str(), actorMorph.first->c_str(), morphableShape->morphPath.c_str());
-				}
-			}
-			actorMorphs->Unlock();
-		});
+			geometry->geometryData = geomData;
+			if(baseData->refCount > 2)
+				InterlockedDecrement(&baseData->refCount);
+			return false;
+		}
+
+		// Welds and adjacency only depend on the base mesh, every actor wearing this shape shares them
+		Morpher::MeshTopologyPtr cachedTopology = morphMap->GetTopology();
+		Morpher::MeshTopologyPtr topology = cachedTopology;
+
+		Morpher::GeometryView view = GetGeometryView(geometry, baseData, newBlock);
+
+#ifdef _DEBUG_DUMPMESH
+		DumpMesh(morphableShape->shapeName, view);
+#endif
+
+		MorphApplicator morpher(view, newBlock, topology);
+
+		// Accumulate straight into the decoded positions, flagging what moves so only that area gets a new frame
+		NiPoint3 * verts = (NiPoint3*)morpher.GetVertices().data();
+		UInt8 * touched = morpher.GetTouched().data();
+		SInt32 outOfBounds = morphMap->ApplyMorphs(weights.data(), geometry->numVertices, verts, touched);
+		if(outOfBounds >= 0) { // Only the first one, prevents spam
+			_WARNING("%s - Shape: %s Morph: %s contained out of bounds vertices\t[%s]", __FUNCTION__, morphableShape->shapeName.c_str(), morphMap->GetMorphName(outOfBounds), morphableShape->morphPath.c_str());
+		}
+
+		morpher.Apply();
+
+		if(shareGeometry) {
+			auto block = std::make_shared<const std::vector<UInt8>>(newBlock, newBlock + blockSize);
+			m_geometryCache.Complete(geometryKey, block, blockSize + geometryKey.GetMemoryUsage());
+		}
+
+		if(topology != cachedTopology && morphMap->ReplaceTopology(cachedTopology, topology)) {
+			SInt64 delta = (SInt64)topology->GetMemoryUsage() - (cachedTopology ? (SInt64)cachedTopology->GetMemoryUsage() : 0);
+
+			// Charge it to the TRI it lives in, unless that was evicted in the meantime
+			m_morphCache.Resize(morphableShape->morphPath, triMap, delta);
+		}
 
 		if(geomData) {
 			geometry->geometryData = geomData;
@@ -646,6 +1215,10 @@ bool BodyMorphInterface::ApplyMorphsToShapes(Actor * actor, NiAVObject * slotNod
 	std::vector<MorphableShapePtr> shapes;
 	GetMorphableShapes(slotNode, shapes);
 
+	// Before the lookups, so the player's files are pinned by the time they are loaded
+	if(actor == (*g_player))
+		UpdatePlayerPins(actor, slotNode);
+
 	if(g_bParallelShapes)
 	{
 		concurrency::parallel_for_each(begin(shapes), end(shapes), [&](const MorphableShapePtr & shape)
@@ -869,7 +1442,7 @@ void MorphValueMap::SetMorph(const BSFixedString & morph, BGSKeyword * keyword,
 	StringTableItem string = g_stringTable.GetString(morph);
 	auto it = find(string);
 	if(it == end()) {
-		userValues = std::make_shared<UserValues>();
+		userValues = std::make_shared<UserValues>(Morpher::GetMorphId(string->c_str(), strlen(string->c_str())));
 		emplace(string, userValues);
 	}
 	else
@@ -1031,7 +1604,7 @@ bool MorphValueMap::Load(const F4SESerializationInterface * intfc, UInt32 kVersi
 						return false;
 					}
 
-					UserValuesPtr userValues = std::make_shared<UserValues>();
+					UserValuesPtr userValues = std::make_shared<UserValues>(Morpher::GetMorphId(it->second->c_str(), strlen(it->second->c_str())));
 					for (UInt32 k = 0; k < numKeys; k++)
 					{
 						UInt64 handle = 0;
@@ -1216,19 +1789,22 @@ void BodyMorphProcessor::Process(BSModelDB::ModelData * modelData, const char *
 				auto triPath = PrefixMeshPath(stringData->m_string);
 				stringData->DecRef();
 
-				auto trishapeMap = g_bodyMorphInterface.GetTrishapeMap(triPath);
+				// Reading the file here would stall the model loader, a loader thread reads it instead
+				bool loading = false;
+				auto trishapeMap = g_bodyMorphInterface.PrefetchTrishapeMap(triPath, &loading);
 				if(trishapeMap)
 				{
-					for(auto & shape : *trishapeMap)
+					for(UInt32 i = 0; i < trishapeMap->GetShapeCount(); i++)
 					{
-						BSAutoFixedString str(shape.first);
+						const char * shapeName = trishapeMap->GetShapeName(i);
+						BSAutoFixedString str(shapeName);
 						NiAVObject * child = object->GetObjectByName(&str);
 						if(child) {
 							child->IncRef();
 							BSTriShape * childShape = child->GetAsBSTriShape();
 							if(childShape) {
 								NiPointer<NiExtraData> morphFile = NiStringExtraData::Create("MORPH_FILE", triPath);
-								NiPointer<NiExtraData> morphShape = NiStringExtraData::Create("MORPH_SHAPE", shape.first);
+								NiPointer<NiExtraData> morphShape = NiStringExtraData::Create("MORPH_SHAPE", shapeName);
 								childShape->AddExtraData(morphFile);
 								childShape->AddExtraData(morphShape);
 							}
@@ -1236,6 +1812,22 @@ void BodyMorphProcessor::Process(BSModelDB::ModelData * modelData, const char *
 						}
 					}
 				}
+				else if(loading)
+				{
+					// Shape names are not known until it is loaded, so shapes only get the file for now
+					// Without a shape tag GetMorphTags matches them against the loaded file, so shapes missing from it are never morphable
+					// A file that failed to load is cached as such and tags nothing
+					VisitObjects(object, [&](NiAVObject * child)
+					{
+						BSTriShape * childShape = child->GetAsBSTriShape();
+						const char * shapeName = childShape ? childShape->m_name.c_str() : nullptr;
+						if(shapeName && shapeName[0] && !child->GetAsBSDynamicTriShape()) {
+							NiPointer<NiExtraData> morphFile = NiStringExtraData::Create("MORPH_FILE", triPath);
+							childShape->AddExtraData(morphFile);
+						}
+						return false;
+					});
+				}
 
 				g_bodyMorphInterface.ShrinkMorphCache();
 			}
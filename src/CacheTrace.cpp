@@ -0,0 +1,134 @@
+#include "CacheTrace.h"
+
+#include <cstring>
+#include <cstdlib>
+
+namespace Morpher
+{
+	bool CacheTraceWriter::Open(const char * path)
+	{
+		std::lock_guard<std::mutex> locker(m_lock);
+		if(m_file)
+			fclose(m_file);
+
+		m_file = fopen(path, "ab");
+		return m_file != nullptr;
+	}
+
+	void CacheTraceWriter::Close()
+	{
+		std::lock_guard<std::mutex> locker(m_lock);
+		if(m_file) {
+			fclose(m_file);
+			m_file = nullptr;
+		}
+	}
+
+	void CacheTraceWriter::Access(const char * key, uint64_t size)
+	{
+		std::lock_guard<std::mutex> locker(m_lock);
+		if(m_file)
+			fprintf(m_file, "A %llu %s\n", (unsigned long long)size, key);
+	}
+
+	void CacheTraceWriter::Pin(const char * key, bool pin)
+	{
+		std::lock_guard<std::mutex> locker(m_lock);
+		if(m_file)
+			fprintf(m_file, "%c %s\n", pin ? 'P' : 'U', key);
+	}
+
+	bool ReadCacheTrace(const char * path, std::vector<CacheTraceEvent> & events)
+	{
+		FILE * file = fopen(path, "rb");
+		if(!file)
+			return false;
+
+		char line[1024];
+		while(fgets(line, sizeof(line), file))
+		{
+			size_t length = strlen(line);
+			while(length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+				line[--length] = 0;
+			if(length < 3 || line[1] != ' ')
+				continue;
+
+			CacheTraceEvent event;
+			event.size = 0;
+			const char * key = line + 2;
+			switch(line[0])
+			{
+			case 'A':
+				{
+					char * end = nullptr;
+					event.type = CacheTraceEvent::kAccess;
+					event.size = strtoull(key, &end, 10);
+					if(end == key || *end != ' ')
+						continue;
+					key = end + 1;
+				}
+				break;
+			case 'P':
+				event.type = CacheTraceEvent::kPin;
+				break;
+			case 'U':
+				event.type = CacheTraceEvent::kUnpin;
+				break;
+			default:
+				continue;
+			}
+
+			event.key = key;
+			if(!event.key.empty())
+				events.push_back(std::move(event));
+		}
+
+		fclose(file);
+		return true;
+	}
+
+	namespace
+	{
+		// The plugin compares paths ignoring case
+		struct KeyHash
+		{
+			size_t operator()(const std::string & key) const { return (size_t)HashLower(key.c_str(), key.size()); }
+		};
+
+		struct KeyEqual
+		{
+			bool operator()(const std::string & a, const std::string & b) const { return a.size() == b.size() && EqualLower(a.c_str(), b.c_str(), b.size()); }
+		};
+	}
+
+	void ReplayCacheTrace(const std::vector<CacheTraceEvent> & events, CachePolicy policy, uint64_t limit, CacheReplayResult & result, float lowWater)
+	{
+		result = CacheReplayResult();
+
+		ShardedCache<std::string, uint64_t, KeyHash, KeyEqual> cache(limit, policy);
+		for(auto & event : events)
+		{
+			if(event.type != CacheTraceEvent::kAccess) {
+				cache.Pin(event.key, event.type == CacheTraceEvent::kPin);
+				continue;
+			}
+
+			result.accesses++;
+			cache.GetOrLoad(event.key, [&](uint64_t & size)
+			{
+				size = event.size;
+				result.bytesLoaded += size;
+				return size;
+			});
+
+			if(cache.GetSize() > result.peakSize)
+				result.peakSize = cache.GetSize();
+			if(cache.IsOverLimit())
+				cache.Shrink((uint64_t)(limit * (double)lowWater));
+		}
+
+		result.hits = cache.GetHits();
+		result.misses = cache.GetMisses();
+		result.evictions = cache.GetEvictions();
+	}
+}
@@ -0,0 +1,41 @@
+#include "GeometryCache.h"
+#include "StringHash.h"
+
+#include <cstring>
+
+namespace Morpher
+{
+	GeometryKey::GeometryKey(const char * morphPath, const char * shapeName, uint64_t vertexDesc, uint32_t numVertices, uint64_t baseHash, const float * weights, uint32_t numWeights)
+		: morphPath(morphPath), shapeName(shapeName), vertexDesc(vertexDesc), numVertices(numVertices), baseHash(baseHash), weights(weights, weights + numWeights)
+	{
+		const uint64_t prime = 1099511628211ULL;
+		uint64_t value = HashLower(this->morphPath.c_str(), this->morphPath.size());
+		value = (value ^ HashLower(this->shapeName.c_str(), this->shapeName.size())) * prime;
+		value = (value ^ vertexDesc) * prime;
+		value = (value ^ numVertices) * prime;
+		value = (value ^ baseHash) * prime;
+		for(float weight : this->weights)
+		{
+			// -0 equals 0, so it has to hash the same
+			uint32_t bits = 0;
+			if(weight != 0.0f)
+				memcpy(&bits, &weight, sizeof(bits));
+			value = (value ^ bits) * prime;
+		}
+		hash = (size_t)value;
+	}
+
+	bool GeometryKey::operator==(const GeometryKey & other) const
+	{
+		if(hash != other.hash || vertexDesc != other.vertexDesc || numVertices != other.numVertices || baseHash != other.baseHash || weights != other.weights)
+			return false;
+
+		return morphPath.size() == other.morphPath.size() && EqualLower(morphPath.c_str(), other.morphPath.c_str(), morphPath.size())
+			&& shapeName.size() == other.shapeName.size() && EqualLower(shapeName.c_str(), other.shapeName.c_str(), shapeName.size());
+	}
+
+	uint64_t GeometryKey::GetMemoryUsage() const
+	{
+		return sizeof(GeometryKey) + morphPath.capacity() + shapeName.capacity() + weights.capacity() * sizeof(float);
+	}
+}
@@ -0,0 +1,112 @@
+#include "MeshDump.h"
+
+#include <cstring>
+
+namespace
+{
+	const uint32_t kDumpMagic = 0x4853454D;	// 'MESH'
+	const uint32_t kDumpVersion = 1;
+
+	enum
+	{
+		kLayout_FullPrecision = 1 << 0,
+		kLayout_UVs = 1 << 1,
+		kLayout_Normals = 1 << 2,
+		kLayout_Tangents = 1 << 3,
+	};
+
+	struct DumpHeader
+	{
+		uint32_t	magic;
+		uint32_t	version;
+		uint32_t	stride;
+		uint32_t	layoutFlags;
+		uint32_t	numVertices;
+		uint32_t	numTriangles;
+	};
+}
+
+namespace Morpher
+{
+	void MeshDump::Assign(const GeometryView & view)
+	{
+		layout = view.layout;
+		numVertices = view.numVertices;
+
+		if(view.vertexBlock)
+			vertexBlock.assign(view.vertexBlock, view.vertexBlock + (size_t)view.numVertices * view.layout.stride);
+		else
+			vertexBlock.assign((size_t)view.numVertices * view.layout.stride, 0);
+
+		if(view.triangles)
+			triangles.assign(view.triangles, view.triangles + view.numTriangles);
+		else
+			triangles.clear();
+	}
+
+	GeometryView MeshDump::GetView()
+	{
+		GeometryView view;
+		view.layout = layout;
+		view.vertexBlock = vertexBlock.data();
+		view.numVertices = numVertices;
+		view.triangles = triangles.empty() ? nullptr : triangles.data();
+		view.numTriangles = (uint32_t)triangles.size();
+		return view;
+	}
+
+	void MeshDump::Serialize(std::vector<uint8_t> & out) const
+	{
+		DumpHeader header;
+		header.magic = kDumpMagic;
+		header.version = kDumpVersion;
+		header.stride = layout.stride;
+		header.layoutFlags = (layout.fullPrecision ? kLayout_FullPrecision : 0) | (layout.hasUVs ? kLayout_UVs : 0) | (layout.hasNormals ? kLayout_Normals : 0) | (layout.hasTangents ? kLayout_Tangents : 0);
+		header.numVertices = numVertices;
+		header.numTriangles = (uint32_t)triangles.size();
+
+		size_t triangleBytes = triangles.size() * sizeof(Triangle);
+		out.resize(sizeof(DumpHeader) + vertexBlock.size() + triangleBytes);
+		memcpy(out.data(), &header, sizeof(DumpHeader));
+		if(!vertexBlock.empty())
+			memcpy(out.data() + sizeof(DumpHeader), vertexBlock.data(), vertexBlock.size());
+		if(triangleBytes)
+			memcpy(out.data() + sizeof(DumpHeader) + vertexBlock.size(), triangles.data(), triangleBytes);
+	}
+
+	bool MeshDump::Deserialize(const uint8_t * data, size_t size)
+	{
+		DumpHeader header;
+		if(size < sizeof(DumpHeader))
+			return false;
+
+		memcpy(&header, data, sizeof(DumpHeader));
+		if(header.magic != kDumpMagic || header.version != kDumpVersion)
+			return false;
+
+		VertexLayout dumpLayout;
+		dumpLayout.stride = header.stride;
+		dumpLayout.fullPrecision = (header.layoutFlags & kLayout_FullPrecision) != 0;
+		dumpLayout.hasUVs = (header.layoutFlags & kLayout_UVs) != 0;
+		dumpLayout.hasNormals = (header.layoutFlags & kLayout_Normals) != 0;
+		dumpLayout.hasTangents = (header.layoutFlags & kLayout_Tangents) != 0;
+
+		// The attributes the codec touches have to fit inside a vertex
+		uint32_t used = dumpLayout.hasNormals ? dumpLayout.TangentOffset() + (dumpLayout.hasTangents ? 4 : 0) : dumpLayout.UVOffset() + (dumpLayout.hasUVs ? 4 : 0);
+		if(dumpLayout.stride < used)
+			return false;
+
+		size_t blockBytes = (size_t)header.numVertices * header.stride;
+		size_t triangleBytes = (size_t)header.numTriangles * sizeof(Triangle);
+		if(size - sizeof(DumpHeader) < blockBytes || size - sizeof(DumpHeader) - blockBytes != triangleBytes)
+			return false;
+
+		layout = dumpLayout;
+		numVertices = header.numVertices;
+		vertexBlock.assign(data + sizeof(DumpHeader), data + sizeof(DumpHeader) + blockBytes);
+		triangles.resize(header.numTriangles);
+		if(triangleBytes)
+			memcpy(triangles.data(), data + sizeof(DumpHeader) + blockBytes, triangleBytes);
+		return true;
+	}
+}
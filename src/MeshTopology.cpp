@@ -0,0 +1,315 @@
+#include "MeshTopology.h"
+
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+	const uint32_t kInvalidIndex = 0xFFFFFFFF;
+
+	// Cells span many weld distances, so only points close to a cell border have to look at the neighbour cell
+	const double kCellScale = 32.0;
+	// Extra border width in cell units, covers rounding of the cell coordinate
+	const double kCellSlack = 0.01;
+	const double kCellLimit = 2147483000.0;
+
+	struct Cell
+	{
+		int32_t x, y, z;
+
+		bool operator==(const Cell & other) const { return x == other.x && y == other.y && z == other.z; }
+	};
+
+	// Open addressing slot, the cell is stored inline so a probe touches a single cache line
+	struct CellSlot
+	{
+		Cell		cell;
+		uint32_t	head;
+	};
+
+	// Returns the cell coordinate and the position inside the cell in [0, 1)
+	int32_t CellCoord(float value, double invCellSize, double & frac)
+	{
+		double scaled = value * invCellSize;
+		double coord = std::floor(scaled);
+		frac = scaled - coord;
+
+		// Far out or invalid positions all share the border cells, the distance test still decides
+		if(!(coord > -kCellLimit)) {
+			frac = 0.5;
+			return (int32_t)-kCellLimit;
+		}
+		if(coord > kCellLimit) {
+			frac = 0.5;
+			return (int32_t)kCellLimit;
+		}
+		return (int32_t)coord;
+	}
+
+	uint32_t HashCell(const Cell & cell)
+	{
+		uint32_t h = ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u);
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		return h;
+	}
+
+	uint32_t FindSlot(const std::vector<CellSlot> & table, uint32_t mask, const Cell & cell)
+	{
+		uint32_t slot = HashCell(cell) & mask;
+		while(table[slot].head != kInvalidIndex && !(table[slot].cell == cell))
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	uint32_t FindRoot(std::vector<uint32_t> & parent, uint32_t i)
+	{
+		while(parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	// The lowest index becomes the root so the grouping does not depend on visiting order
+	void Union(std::vector<uint32_t> & parent, uint32_t a, uint32_t b)
+	{
+		a = FindRoot(parent, a);
+		b = FindRoot(parent, b);
+		if(a < b)
+			parent[b] = a;
+		else if(b < a)
+			parent[a] = b;
+	}
+
+	// Same test the kd_matcher used, strictly closer than epsilon on every axis
+	bool IsWelded(const Morpher::Vector3 & a, const Morpher::Vector3 & b, double epsilon)
+	{
+		return fabs(a.x - b.x) < epsilon && fabs(a.y - b.y) < epsilon && fabs(a.z - b.z) < epsilon;
+	}
+}
+
+namespace Morpher
+{
+	void WeldGroups::Clear()
+	{
+		m_offsets.clear();
+		m_members.clear();
+	}
+
+	void WeldGroups::Build(const Vector3 * points, uint32_t numPoints, double epsilon)
+	{
+		Clear();
+		if(numPoints < 2)
+			return;
+
+		const double invCellSize = 1.0 / (epsilon * kCellScale);
+		const double border = 1.0 / kCellScale + kCellSlack;
+
+		// Bucket the points by cell, each occupied slot holds the head of a chain through next
+		uint32_t tableSize = 1;
+		while(tableSize < numPoints * 2)
+			tableSize <<= 1;
+		const uint32_t tableMask = tableSize - 1;
+
+		const CellSlot emptySlot = { { 0, 0, 0 }, kInvalidIndex };
+		std::vector<CellSlot> table(tableSize, emptySlot);
+		std::vector<uint32_t> next(numPoints, kInvalidIndex);
+		std::vector<Cell> cells(numPoints);
+		std::vector<uint8_t> sides(numPoints);
+
+		for(uint32_t i = 0; i < numPoints; i++)
+		{
+			double frac[3];
+			Cell & cell = cells[i];
+			cell.x = CellCoord(points[i].x, invCellSize, frac[0]);
+			cell.y = CellCoord(points[i].y, invCellSize, frac[1]);
+			cell.z = CellCoord(points[i].z, invCellSize, frac[2]);
+
+			// Two bits per axis, low neighbour and high neighbour
+			uint8_t side = 0;
+			for(uint32_t a = 0; a < 3; a++)
+			{
+				if(frac[a] < border)
+					side |= 1 << (a * 2);
+				if(frac[a] > 1.0 - border)
+					side |= 2 << (a * 2);
+			}
+			sides[i] = side;
+
+			CellSlot & slot = table[FindSlot(table, tableMask, cell)];
+			slot.cell = cell;
+			next[i] = slot.head;
+			slot.head = i;
+		}
+
+		std::vector<uint32_t> parent(numPoints);
+		std::iota(parent.begin(), parent.end(), 0);
+
+		bool anyWelds = false;
+		for(uint32_t i = 0; i < numPoints; i++)
+		{
+			const Cell & cell = cells[i];
+			const uint8_t side = sides[i];
+
+			for(int32_t dx = -1; dx <= 1; dx++)
+			{
+				if((dx < 0 && !(side & 0x01)) || (dx > 0 && !(side & 0x02)))
+					continue;
+				for(int32_t dy = -1; dy <= 1; dy++)
+				{
+					if((dy < 0 && !(side & 0x04)) || (dy > 0 && !(side & 0x08)))
+						continue;
+					for(int32_t dz = -1; dz <= 1; dz++)
+					{
+						if((dz < 0 && !(side & 0x10)) || (dz > 0 && !(side & 0x20)))
+							continue;
+
+						Cell neighbor = { cell.x + dx, cell.y + dy, cell.z + dz };
+						uint32_t head = table[FindSlot(table, tableMask, neighbor)].head;
+
+						// Chains run from the highest index down, only pairs with the lower index are tested
+						for(uint32_t j = head; j != kInvalidIndex; j = next[j])
+						{
+							if(j < i && IsWelded(points[i], points[j], epsilon)) {
+								Union(parent, i, j);
+								anyWelds = true;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		if(!anyWelds)
+			return;
+
+		// Flatten into CSR, groups ordered by their lowest member and members ascending
+		std::vector<uint32_t> & groupSize = next;
+		std::fill(groupSize.begin(), groupSize.end(), 0);
+		for(uint32_t i = 0; i < numPoints; i++) {
+			parent[i] = FindRoot(parent, i);
+			groupSize[parent[i]]++;
+		}
+
+		std::vector<uint32_t> groupIndex(numPoints, kInvalidIndex);
+
+		m_offsets.push_back(0);
+		for(uint32_t i = 0; i < numPoints; i++)
+		{
+			if(parent[i] == i && groupSize[i] > 1) {
+				groupIndex[i] = (uint32_t)m_offsets.size() - 1;
+				m_offsets.push_back(m_offsets.back() + groupSize[i]);
+			}
+		}
+
+		m_members.resize(m_offsets.back());
+		std::vector<uint32_t> cursor(m_offsets.begin(), m_offsets.end() - 1);
+		for(uint32_t i = 0; i < numPoints; i++)
+		{
+			uint32_t group = groupIndex[parent[i]];
+			if(group != kInvalidIndex)
+				m_members[cursor[group]++] = i;
+		}
+	}
+
+	size_t WeldGroups::GetMemoryUsage() const
+	{
+		return sizeof(WeldGroups) + (m_offsets.capacity() + m_members.capacity()) * sizeof(uint32_t);
+	}
+
+	void MeshTopology::Build(const Vector3 * weldPositions, uint32_t numVertices, const Triangle * triangles, uint32_t numTriangles)
+	{
+		m_numVertices = numVertices;
+		m_numTriangles = numTriangles;
+		m_triangleHash = HashTriangles(triangles, numTriangles);
+
+		m_welds.Build(weldPositions, numVertices);
+
+		// Counting sort of the triangle corners by vertex, triangles end up ascending per vertex so sums keep their order
+		m_vertexOffsets.assign(numVertices + 1, 0);
+		for(uint32_t t = 0; t < numTriangles; t++)
+		{
+			const uint16_t corners[3] = { triangles[t].p1, triangles[t].p2, triangles[t].p3 };
+			for(uint32_t c = 0; c < 3; c++)
+			{
+				if(corners[c] < numVertices)
+					m_vertexOffsets[corners[c] + 1]++;
+			}
+		}
+
+		for(uint32_t v = 0; v < numVertices; v++)
+			m_vertexOffsets[v + 1] += m_vertexOffsets[v];
+
+		m_vertexTriangles.resize(m_vertexOffsets[numVertices]);
+		std::vector<uint32_t> cursor(m_vertexOffsets.begin(), m_vertexOffsets.end() - 1);
+		for(uint32_t t = 0; t < numTriangles; t++)
+		{
+			const uint16_t corners[3] = { triangles[t].p1, triangles[t].p2, triangles[t].p3 };
+			for(uint32_t c = 0; c < 3; c++)
+			{
+				if(corners[c] < numVertices)
+					m_vertexTriangles[cursor[corners[c]]++] = t;
+			}
+		}
+	}
+
+	bool MeshTopology::Matches(uint32_t numVertices, const Triangle * triangles, uint32_t numTriangles) const
+	{
+		return m_numVertices == numVertices && m_numTriangles == numTriangles && m_triangleHash == HashTriangles(triangles, numTriangles);
+	}
+
+	size_t MeshTopology::GetMemoryUsage() const
+	{
+		return sizeof(MeshTopology) + m_welds.GetMemoryUsage() - sizeof(WeldGroups) + (m_vertexOffsets.capacity() + m_vertexTriangles.capacity()) * sizeof(uint32_t);
+	}
+
+	uint64_t MeshTopology::HashTriangles(const Triangle * triangles, uint32_t numTriangles)
+	{
+		// FNV-1a over the packed indices
+		uint64_t hash = 14695981039346656037ULL;
+		for(uint32_t t = 0; t < numTriangles; t++)
+		{
+			uint64_t packed = (uint64_t)triangles[t].p1 | ((uint64_t)triangles[t].p2 << 16) | ((uint64_t)triangles[t].p3 << 32);
+			hash ^= packed;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	void SmoothWeldedNormals(const WeldGroups & groups, Vector3 * normals, float smoothThresh, const uint8_t * mask)
+	{
+		const float thresh = smoothThresh * DEG2RAD;
+		static thread_local std::vector<Vector3> blended;
+
+		for(uint32_t g = 0; g < groups.GetGroupCount(); g++)
+		{
+			const uint32_t * members = groups.GroupBegin(g);
+			const uint32_t count = (uint32_t)(groups.GroupEnd(g) - members);
+			if(mask && !mask[members[0]])
+				continue;
+
+			// Blend from the unsmoothed normals so the result does not depend on member order
+			blended.resize(count);
+			for(uint32_t a = 0; a < count; a++)
+				blended[a] = normals[members[a]];
+
+			for(uint32_t a = 0; a < count; a++)
+			{
+				const Vector3 & an = normals[members[a]];
+				for(uint32_t b = a + 1; b < count; b++)
+				{
+					const Vector3 & bn = normals[members[b]];
+					if(an.angle(bn) < thresh) {
+						blended[a] += bn;
+						blended[b] += an;
+					}
+				}
+			}
+
+			for(uint32_t a = 0; a < count; a++)
+				normals[members[a]] = blended[a];
+		}
+	}
+}
@@ -0,0 +1,31 @@
+#include "MorphIds.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cctype>
+
+namespace
+{
+	std::mutex									s_morphIdLock;
+	std::unordered_map<std::string, uint32_t>	s_morphIds;	// Lower case names
+}
+
+namespace Morpher
+{
+	uint32_t GetMorphId(const char * name, size_t length)
+	{
+		std::string key(name, length);
+		for(auto & c : key)
+			c = (char)tolower((unsigned char)c);
+
+		std::lock_guard<std::mutex> locker(s_morphIdLock);
+		return s_morphIds.emplace(std::move(key), (uint32_t)s_morphIds.size()).first->second;
+	}
+
+	uint32_t GetMorphIdCount()
+	{
+		std::lock_guard<std::mutex> locker(s_morphIdLock);
+		return (uint32_t)s_morphIds.size();
+	}
+}
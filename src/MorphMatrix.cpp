@@ -0,0 +1,513 @@
+#include "MorphMatrix.h"
+#include "Morpher.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MORPH_MATRIX_SSE
+#endif
+
+namespace
+{
+	// Rows handled together, the sparse rows and every dense column of a block run while its vertices are still in cache
+	const uint32_t kRowBlock = 1024;
+
+	float s_denseMorphDensity = 0.5f;
+
+	// Packed deltas are dequantized with the same rounding the per morph loops had, returns false for a delta that moves nothing
+	bool ReadDelta(const Morpher::TriArena & arena, const Morpher::TriArena::Morph & morph, uint32_t d, uint32_t & index, float * delta)
+	{
+		if (arena.IsPacked())
+		{
+			const Morpher::TriPackedVertexDelta & packed = arena.GetPackedDeltas(morph)[d];
+			index = packed.index;
+			delta[0] = (float)packed.x * morph.multiplier;
+			delta[1] = (float)packed.y * morph.multiplier;
+			delta[2] = (float)packed.z * morph.multiplier;
+		}
+		else
+		{
+			const Morpher::TriVertexDelta & full = arena.GetDeltas(morph)[d];
+			index = full.index;
+			delta[0] = full.x;
+			delta[1] = full.y;
+			delta[2] = full.z;
+		}
+
+		return delta[0] != 0.0f || delta[1] != 0.0f || delta[2] != 0.0f;
+	}
+
+#ifdef MORPH_MATRIX_SSE
+	// Four signed 16 bit values from the low half of the register as floats
+	__m128 WidenLow(__m128i packed)
+	{
+		return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+	}
+
+	__m128 WidenHigh(__m128i packed)
+	{
+		return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16));
+	}
+#endif
+}
+
+namespace Morpher
+{
+	void SetDenseMorphDensity(float density)
+	{
+		s_denseMorphDensity = density;
+	}
+
+	float GetDenseMorphDensity()
+	{
+		return s_denseMorphDensity;
+	}
+
+	void MorphMatrix::Build(const TriArena & arena, const TriArena::Shape & shape)
+	{
+		Clear();
+
+		const TriArena::Morph * morphs = arena.GetMorphs() + shape.firstMorph;
+		m_numColumns = shape.numMorphs;
+		m_columnEnds.assign(m_numColumns, 0);
+
+		// Packed entries carry their column in 16 bits, shapes with more morphs than that fall back to floats
+		m_packed = arena.IsPacked() && m_numColumns <= 0x10000;
+
+		// Span and delta count of every morph decide how it is stored
+		// A morph listing a vertex twice moves it by both deltas, it stays sparse where each is an entry of its own
+		std::vector<uint32_t> firstRows(m_numColumns, 0);
+		std::vector<uint32_t> numDeltas(m_numColumns, 0);
+		std::vector<uint8_t> repeats(m_numColumns, 0);
+		std::vector<uint32_t> seen;
+		uint32_t numRows = 0;
+		uint32_t index;
+		float delta[3];
+		for (uint32_t c = 0; c < m_numColumns; c++)
+		{
+			uint32_t first = UINT32_MAX;
+			for (uint32_t d = 0; d < morphs[c].numDeltas; d++)
+			{
+				if (!ReadDelta(arena, morphs[c], d, index, delta))
+					continue;
+
+				if (index >= seen.size())
+					seen.resize(index + 1, UINT32_MAX);
+				repeats[c] |= seen[index] == c;
+				seen[index] = c;
+
+				first = (std::min)(first, index);
+				m_columnEnds[c] = (std::max)(m_columnEnds[c], index + 1);
+				numDeltas[c]++;
+			}
+
+			firstRows[c] = numDeltas[c] ? first : 0;
+			numRows = (std::max)(numRows, m_columnEnds[c]);
+		}
+
+		if (numRows == 0)
+			return;
+
+		if (m_packed)
+		{
+			m_multipliers.resize(m_numColumns);
+			for (uint32_t c = 0; c < m_numColumns; c++)
+				m_multipliers[c] = morphs[c].multiplier;
+		}
+
+		std::vector<uint8_t> dense(m_numColumns, 0);
+		size_t denseSize = 0;
+		for (uint32_t c = 0; c < m_numColumns; c++)
+		{
+			uint32_t span = m_columnEnds[c] - firstRows[c];
+			if (numDeltas[c] && !repeats[c] && s_denseMorphDensity <= 1.0f && numDeltas[c] >= s_denseMorphDensity * span)
+			{
+				DenseColumn column = { c, firstRows[c], span, denseSize, false };
+				m_denseColumns.push_back(column);
+				denseSize += (size_t)span * 3;
+				dense[c] = 1;
+			}
+		}
+
+		// Count the sparse entries per row, then lay them out
+		std::vector<uint32_t> counts(numRows, 0);
+		for (uint32_t c = 0; c < m_numColumns; c++)
+		{
+			if (dense[c])
+				continue;
+
+			for (uint32_t d = 0; d < morphs[c].numDeltas; d++)
+			{
+				if (ReadDelta(arena, morphs[c], d, index, delta))
+					counts[index]++;
+			}
+		}
+
+		m_offsets.resize(numRows + 1);
+		m_offsets[0] = 0;
+		for (uint32_t r = 0; r < numRows; r++)
+			m_offsets[r + 1] = m_offsets[r] + counts[r];
+
+		uint32_t numEntries = m_offsets[numRows];
+		if (m_packed)
+		{
+			m_packedEntries.resize(numEntries);
+			m_packedDense.assign(denseSize, 0);
+		}
+		else
+		{
+			m_columns.resize(numEntries);
+			m_deltas.assign((size_t)numEntries * 3 + 1, 0.0f);
+			m_dense.assign(denseSize, 0.0f);
+		}
+
+		// Columns go in ascending, so the entries of a row follow the morph order
+		std::vector<uint32_t> & next = counts;
+		std::copy(m_offsets.begin(), m_offsets.end() - 1, next.begin());
+		auto denseColumn = m_denseColumns.begin();
+		for (uint32_t c = 0; c < m_numColumns; c++)
+		{
+			size_t denseOffset = SIZE_MAX;
+			if (dense[c])
+				denseOffset = (denseColumn++)->offset;
+
+			for (uint32_t d = 0; d < morphs[c].numDeltas; d++)
+			{
+				if (!ReadDelta(arena, morphs[c], d, index, delta))
+					continue;
+
+				if (m_packed)
+				{
+					const TriPackedVertexDelta & packed = arena.GetPackedDeltas(morphs[c])[d];
+					if (denseOffset != SIZE_MAX)
+					{
+						int16_t * target = &m_packedDense[denseOffset + (size_t)(index - firstRows[c]) * 3];
+						target[0] = packed.x;
+						target[1] = packed.y;
+						target[2] = packed.z;
+					}
+					else
+					{
+						PackedEntry & entry = m_packedEntries[next[index]++];
+						entry.x = packed.x;
+						entry.y = packed.y;
+						entry.z = packed.z;
+						entry.column = (uint16_t)c;
+					}
+				}
+				else if (denseOffset != SIZE_MAX)
+				{
+					float * target = &m_dense[denseOffset + (size_t)(index - firstRows[c]) * 3];
+					target[0] = delta[0];
+					target[1] = delta[1];
+					target[2] = delta[2];
+				}
+				else
+				{
+					uint32_t entry = next[index]++;
+					float * target = &m_deltas[(size_t)entry * 3];
+					target[0] = delta[0];
+					target[1] = delta[1];
+					target[2] = delta[2];
+					m_columns[entry] = c;
+				}
+			}
+		}
+
+		// Spans without gaps flag every row they cover without looking at the deltas
+		for (auto & column : m_denseColumns)
+		{
+			for (uint32_t r = 0; r < column.count && !column.gaps; r++)
+			{
+				size_t offset = column.offset + (size_t)r * 3;
+				if (m_packed)
+					column.gaps = m_packedDense[offset] == 0 && m_packedDense[offset + 1] == 0 && m_packedDense[offset + 2] == 0;
+				else
+					column.gaps = m_dense[offset] == 0.0f && m_dense[offset + 1] == 0.0f && m_dense[offset + 2] == 0.0f;
+			}
+		}
+	}
+
+	void MorphMatrix::Clear()
+	{
+		m_packed = false;
+		m_numColumns = 0;
+		std::vector<uint32_t>().swap(m_columnEnds);
+		std::vector<uint32_t>().swap(m_offsets);
+		std::vector<uint32_t>().swap(m_columns);
+		std::vector<float>().swap(m_deltas);
+		std::vector<DenseColumn>().swap(m_denseColumns);
+		std::vector<float>().swap(m_dense);
+		std::vector<float>().swap(m_multipliers);
+		std::vector<PackedEntry>().swap(m_packedEntries);
+		std::vector<int16_t>().swap(m_packedDense);
+	}
+
+	int32_t MorphMatrix::Apply(const float * weights, Vector3 * vertices, uint32_t numVertices, uint8_t * touched) const
+	{
+		uint32_t numRows = GetRowCount();
+		uint32_t rows = (std::min)(numRows, numVertices);
+
+		// Packed columns take their multiplier into the weight, so the kernels only widen the deltas
+		const float * columnWeights = weights;
+		std::vector<float> scaledWeights;
+		if (m_packed)
+		{
+			scaledWeights.resize(m_numColumns);
+			for (uint32_t c = 0; c < m_numColumns; c++)
+				scaledWeights[c] = weights[c] * m_multipliers[c];
+			columnWeights = scaledWeights.data();
+		}
+
+		std::vector<WeightedColumn> weighted;
+		for (auto & dense : m_denseColumns)
+		{
+			if (columnWeights[dense.column] != 0.0f) {
+				WeightedColumn column = { &dense, columnWeights[dense.column] };
+				weighted.push_back(column);
+			}
+		}
+
+		// Every row only writes its own vertex, so ranges need no synchronization
+		ForEachRange(rows, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t block = begin; block < end; block += kRowBlock)
+			{
+				uint32_t blockEnd = (std::min)(end, block + kRowBlock);
+				if (m_packed)
+				{
+					ApplyPackedRows(columnWeights, vertices, block, blockEnd, touched);
+					for (auto & column : weighted)
+						ApplyPackedDense(column, vertices, block, blockEnd, touched);
+				}
+				else
+				{
+					ApplyRows(columnWeights, vertices, block, blockEnd, touched);
+					for (auto & column : weighted)
+						ApplyDense(column, vertices, block, blockEnd, touched);
+				}
+			}
+		});
+
+		for (uint32_t c = 0; c < m_numColumns; c++)
+		{
+			if (m_columnEnds[c] > numVertices && weights[c] != 0.0f)
+				return (int32_t)c;
+		}
+
+		return -1;
+	}
+
+	void MorphMatrix::ApplyRows(const float * weights, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const
+	{
+		const uint32_t * offsets = m_offsets.data();
+		const uint32_t * columns = m_columns.data();
+		const float * deltas = m_deltas.data();
+
+		for (uint32_t r = begin; r < end; r++)
+		{
+			uint32_t first = offsets[r];
+			uint32_t last = offsets[r + 1];
+
+			// Unweighted columns add zero, testing the weights instead of branching on them keeps the loop straight
+			bool moved = false;
+#ifdef MORPH_MATRIX_SSE
+			// Two sums in turn, so consecutive entries do not wait on each other's add
+			__m128 sum = _mm_setzero_ps();
+			__m128 other = _mm_setzero_ps();
+			uint32_t e = first;
+			for (; e + 1 < last; e += 2)
+			{
+				float weight = weights[columns[e]];
+				float next = weights[columns[e + 1]];
+				moved |= weight != 0.0f || next != 0.0f;
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(deltas + (size_t)e * 3), _mm_set1_ps(weight)));
+				other = _mm_add_ps(other, _mm_mul_ps(_mm_loadu_ps(deltas + (size_t)e * 3 + 3), _mm_set1_ps(next)));
+			}
+			if (e < last)
+			{
+				float weight = weights[columns[e]];
+				moved |= weight != 0.0f;
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(deltas + (size_t)e * 3), _mm_set1_ps(weight)));
+			}
+			sum = _mm_add_ps(sum, other);
+
+			if (!moved)
+				continue;
+
+			// The fourth lane holds the next entry's X, only the first three are used
+			float result[4];
+			_mm_storeu_ps(result, sum);
+			vertices[r].x += result[0];
+			vertices[r].y += result[1];
+			vertices[r].z += result[2];
+#else
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			for (uint32_t e = first; e < last; e++)
+			{
+				float weight = weights[columns[e]];
+				const float * delta = deltas + (size_t)e * 3;
+				moved |= weight != 0.0f;
+				x += delta[0] * weight;
+				y += delta[1] * weight;
+				z += delta[2] * weight;
+			}
+
+			if (!moved)
+				continue;
+
+			vertices[r].x += x;
+			vertices[r].y += y;
+			vertices[r].z += z;
+#endif
+			if (touched)
+				touched[r] = 1;
+		}
+	}
+
+	void MorphMatrix::ApplyPackedRows(const float * weights, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const
+	{
+		const uint32_t * offsets = m_offsets.data();
+		const PackedEntry * entries = m_packedEntries.data();
+
+		for (uint32_t r = begin; r < end; r++)
+		{
+			uint32_t first = offsets[r];
+			uint32_t last = offsets[r + 1];
+
+			bool moved = false;
+#ifdef MORPH_MATRIX_SSE
+			// Two entries per load, each half widened on its own
+			__m128 sum = _mm_setzero_ps();
+			__m128 other = _mm_setzero_ps();
+			uint32_t e = first;
+			for (; e + 1 < last; e += 2)
+			{
+				float weight = weights[entries[e].column];
+				float next = weights[entries[e + 1].column];
+				moved |= weight != 0.0f || next != 0.0f;
+				__m128i pair = _mm_loadu_si128((const __m128i *)(entries + e));
+				sum = _mm_add_ps(sum, _mm_mul_ps(WidenLow(pair), _mm_set1_ps(weight)));
+				other = _mm_add_ps(other, _mm_mul_ps(WidenHigh(pair), _mm_set1_ps(next)));
+			}
+			if (e < last)
+			{
+				float weight = weights[entries[e].column];
+				moved |= weight != 0.0f;
+				sum = _mm_add_ps(sum, _mm_mul_ps(WidenLow(_mm_loadl_epi64((const __m128i *)(entries + e))), _mm_set1_ps(weight)));
+			}
+			sum = _mm_add_ps(sum, other);
+
+			if (!moved)
+				continue;
+
+			// The fourth lane is the weighted column number, only the first three are used
+			float result[4];
+			_mm_storeu_ps(result, sum);
+			vertices[r].x += result[0];
+			vertices[r].y += result[1];
+			vertices[r].z += result[2];
+#else
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			for (uint32_t e = first; e < last; e++)
+			{
+				const PackedEntry & entry = entries[e];
+				float weight = weights[entry.column];
+				moved |= weight != 0.0f;
+				x += (float)entry.x * weight;
+				y += (float)entry.y * weight;
+				z += (float)entry.z * weight;
+			}
+
+			if (!moved)
+				continue;
+
+			vertices[r].x += x;
+			vertices[r].y += y;
+			vertices[r].z += z;
+#endif
+			if (touched)
+				touched[r] = 1;
+		}
+	}
+
+	void MorphMatrix::ApplyDense(const WeightedColumn & weighted, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const
+	{
+		const DenseColumn & dense = *weighted.dense;
+		uint32_t first = (std::max)(begin, dense.first);
+		uint32_t last = (std::min)(end, dense.first + dense.count);
+		if (first >= last)
+			return;
+
+		// Positions and deltas are both three values per row, so the block is one run on each side
+		float * target = &vertices[first].x;
+		const float * deltas = &m_dense[dense.offset + (size_t)(first - dense.first) * 3];
+		uint32_t count = (last - first) * 3;
+		uint32_t i = 0;
+#ifdef MORPH_MATRIX_SSE
+		__m128 weight = _mm_set1_ps(weighted.weight);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(_mm_loadu_ps(deltas + i), weight)));
+#endif
+		for (; i < count; i++)
+			target[i] += deltas[i] * weighted.weight;
+
+		// Gaps inside the span hold zero deltas, those vertices did not move
+		if (touched && !dense.gaps)
+			std::fill(touched + first, touched + last, 1);
+		else if (touched)
+		{
+			for (uint32_t r = first; r < last; r++)
+			{
+				const float * delta = deltas + (size_t)(r - first) * 3;
+				if (delta[0] != 0.0f || delta[1] != 0.0f || delta[2] != 0.0f)
+					touched[r] = 1;
+			}
+		}
+	}
+
+	void MorphMatrix::ApplyPackedDense(const WeightedColumn & weighted, Vector3 * vertices, uint32_t begin, uint32_t end, uint8_t * touched) const
+	{
+		const DenseColumn & dense = *weighted.dense;
+		uint32_t first = (std::max)(begin, dense.first);
+		uint32_t last = (std::min)(end, dense.first + dense.count);
+		if (first >= last)
+			return;
+
+		float * target = &vertices[first].x;
+		const int16_t * deltas = &m_packedDense[dense.offset + (size_t)(first - dense.first) * 3];
+		uint32_t count = (last - first) * 3;
+		uint32_t i = 0;
+#ifdef MORPH_MATRIX_SSE
+		__m128 weight = _mm_set1_ps(weighted.weight);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i packed = _mm_loadu_si128((const __m128i *)(deltas + i));
+			_mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(WidenLow(packed), weight)));
+			_mm_storeu_ps(target + i + 4, _mm_add_ps(_mm_loadu_ps(target + i + 4), _mm_mul_ps(WidenHigh(packed), weight)));
+		}
+#endif
+		for (; i < count; i++)
+			target[i] += (float)deltas[i] * weighted.weight;
+
+		if (touched && !dense.gaps)
+			std::fill(touched + first, touched + last, 1);
+		else if (touched)
+		{
+			for (uint32_t r = first; r < last; r++)
+			{
+				const int16_t * delta = deltas + (size_t)(r - first) * 3;
+				if (delta[0] != 0 || delta[1] != 0 || delta[2] != 0)
+					touched[r] = 1;
+			}
+		}
+	}
+
+	size_t MorphMatrix::GetMemoryUsage() const
+	{
+		return m_columnEnds.capacity() * sizeof(uint32_t) + m_offsets.capacity() * sizeof(uint32_t) + m_columns.capacity() * sizeof(uint32_t) + m_deltas.capacity() * sizeof(float) +
+			m_denseColumns.capacity() * sizeof(DenseColumn) + m_dense.capacity() * sizeof(float) +
+			m_multipliers.capacity() * sizeof(float) + m_packedEntries.capacity() * sizeof(PackedEntry) + m_packedDense.capacity() * sizeof(int16_t);
+	}
+}
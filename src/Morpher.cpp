@@ -1,190 +1,326 @@
 #include "Morpher.h"
 #include <cmath>
-#undef min
-#undef max
-#include "half.hpp"
-#include "f4se/BSGeometry.h"
-
-float round_v(float num)
-{
-	return (num > 0.0) ? floor(num + 0.5) : ceil(num - 0.5);
-}
-
-MorphApplicator::MorphApplicator(BSTriShape * _geometry, UInt8 * srcBlock, UInt8 * dstBlock, std::function<void(std::vector<Morpher::Vector3> &)> morph) : geometry(_geometry), morphFunc(morph)
+#include <cstring>
+#include <memory>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <ppl.h>
+#else
+#include <atomic>
+#include <thread>
+#endif
+
+namespace
 {
-	UInt64 vertexDesc = geometry->vertexDesc;
-	UInt32 vertexSize = geometry->GetVertexSize();
-	UInt32 blockSize = geometry->numVertices * vertexSize;
-	BSGeometryData * geomData = geometry->geometryData;
-	UInt32 numVertices = geometry->numVertices;
+	// Items handed to a worker at once, large enough to amortize the scheduling
+	const uint32_t kParallelChunk = 1024;
 
-	// Pull the base data from the vertex block
-	rawVertices.resize(numVertices);
-	if(vertexDesc & BSTriShape::kFlag_UVs)
-		rawUV.resize(numVertices);
+	uint32_t s_parallelVertexThreshold = 8192;
 
-	if(vertexDesc & BSTriShape::kFlag_Normals) {
-		rawNormals.resize(numVertices);
-		if(vertexDesc & BSTriShape::kFlag_Tangents) {
-			rawTangents.resize(numVertices);
-			rawBitangents.resize(numVertices);
+	// Runs func for every item, split across the ppl scheduler once there are enough of them
+	// Each item only writes its own outputs, so the result does not depend on the thread count
+	template<typename F>
+	void ForEachItem(const std::vector<uint32_t> & items, F func)
+	{
+		uint32_t count = items.size();
+		if (s_parallelVertexThreshold == 0 || count < s_parallelVertexThreshold)
+		{
+			for (uint32_t i = 0; i < count; i++)
+				func(items[i]);
+			return;
 		}
+
+		Morpher::ForEachRange(count, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+				func(items[i]);
+		});
 	}
 
-	UInt8 * vertexBlock = srcBlock ? srcBlock : geomData->vertexData->vertexBlock;
-	for(UInt32 i = 0; i < numVertices; i++)
+	// Normals are built in a rescaled space with Y and Z swapped, the weld distance is measured there too
+	void ToNormalSpace(const std::vector<Morpher::Vector3> & src, std::vector<Morpher::Vector3> & dst)
 	{
-		UInt8 * vBegin = &vertexBlock[i * vertexSize];
-
-		if(vertexDesc & BSTriShape::kFlag_FullPrecision)
+		dst.resize(src.size());
+		for (size_t i = 0; i < src.size(); i++)
 		{
-			rawVertices[i].x = (*(float *)vBegin); vBegin += 4;
-			rawVertices[i].y = (*(float *)vBegin); vBegin += 4;
-			rawVertices[i].z = (*(float *)vBegin); vBegin += 4;
-
-			vBegin += 4; // Skip BitangetX
+			dst[i].x = src[i].x * -0.1f;
+			dst[i].z = src[i].y * 0.1f;
+			dst[i].y = src[i].z * 0.1f;
 		}
-		else
-		{
-			rawVertices[i].x = (*(half_float::half *)vBegin); vBegin += 2;
-			rawVertices[i].y = (*(half_float::half *)vBegin); vBegin += 2;
-			rawVertices[i].z = (*(half_float::half *)vBegin); vBegin += 2;
+	}
 
-			vBegin += 2; // Skip BitangetX
-		}
+	bool IsValidTriangle(const Morpher::Triangle & tri, uint32_t numVertices)
+	{
+		return tri.p1 < numVertices && tri.p2 < numVertices && tri.p3 < numVertices;
+	}
 
-		if(vertexDesc & BSTriShape::kFlag_UVs)
-		{
-			rawUV[i].u = (*(half_float::half *)vBegin); vBegin += 2;
-			rawUV[i].v = (*(half_float::half *)vBegin); vBegin += 2;
-		}
+	// While a ppl wait is pending the thread may run another shape's morph, so nested applicators take the next set
+	thread_local std::vector<std::unique_ptr<MorphScratch>> t_scratchPool;
+	thread_local uint32_t t_scratchDepth = 0;
+
+	MorphScratch * AcquireScratch()
+	{
+		if (t_scratchDepth == t_scratchPool.size())
+			t_scratchPool.emplace_back(new MorphScratch);
+
+		return t_scratchPool[t_scratchDepth++].get();
 	}
 
-	morphFunc(rawVertices);
+	void ReleaseScratch()
+	{
+		t_scratchDepth--;
+	}
+}
 
-	Morpher::Triangle* triangles = nullptr;
-	auto triangleData = geomData->triangleData;
-	if(triangleData)
-		triangles = (Morpher::Triangle*)triangleData->triangles;
+namespace Morpher
+{
+	void SetParallelVertexThreshold(uint32_t threshold)
+	{
+		s_parallelVertexThreshold = threshold;
+	}
 
-	RecalcNormals(geometry->numTriangles, triangles);
-	CalcTangentSpace(geometry->numTriangles, triangles);
-	
-	vertexBlock = dstBlock ? dstBlock : geomData->vertexData->vertexBlock;
-	for(UInt32 i = 0; i < numVertices; i++)
+	uint32_t GetParallelVertexThreshold()
 	{
-		UInt8 * vBegin = &vertexBlock[i * vertexSize];
+		return s_parallelVertexThreshold;
+	}
 
-		if(vertexDesc & BSTriShape::kFlag_FullPrecision)
+	void ForEachRange(uint32_t count, const std::function<void(uint32_t, uint32_t)> & func)
+	{
+		if (s_parallelVertexThreshold == 0 || count < s_parallelVertexThreshold)
 		{
-			(*(float *)vBegin) = rawVertices[i].x; vBegin += 4;
-			(*(float *)vBegin) = rawVertices[i].y; vBegin += 4;
-			(*(float *)vBegin) = rawVertices[i].z; vBegin += 4;
-
-			(*(float *)vBegin) = rawBitangents[i].x; vBegin += 4;
+			if (count)
+				func(0, count);
+			return;
 		}
-		else
+
+		uint32_t numChunks = (count + kParallelChunk - 1) / kParallelChunk;
+		auto runChunk = [&](uint32_t chunk)
+		{
+			func(chunk * kParallelChunk, (std::min)(count, (chunk + 1) * kParallelChunk));
+		};
+
+#ifdef _MSC_VER
+		concurrency::parallel_for(0U, numChunks, runChunk);
+#else
+		// No ppl outside of MSVC, plain threads pull chunks until none are left
+		std::atomic<uint32_t> nextChunk(0);
+		auto worker = [&]()
 		{
-			(*(half_float::half *)vBegin) = rawVertices[i].x; vBegin += 2;
-			(*(half_float::half *)vBegin) = rawVertices[i].y; vBegin += 2;
-			(*(half_float::half *)vBegin) = rawVertices[i].z; vBegin += 2;
+			for (uint32_t chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++)
+				runChunk(chunk);
+		};
+
+		uint32_t numThreads = (std::min)(numChunks, (std::max)(1U, std::thread::hardware_concurrency()));
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads - 1);
+		for (uint32_t t = 1; t < numThreads; t++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto & thread : threads)
+			thread.join();
+#endif
+	}
+}
 
-			(*(half_float::half *)vBegin) = rawBitangents[i].x; vBegin += 2;
-		}
+MorphApplicator::MorphApplicator(const Morpher::GeometryView & _geometry, uint8_t * dstBlock, Morpher::MeshTopologyPtr & _topology) : layout(_geometry.layout), scratch(AcquireScratch()),
+	touched(scratch->touched), regionMask(scratch->regionMask), regionVertices(scratch->regionVertices), regionTriangles(scratch->regionTriangles),
+	rawVertices(scratch->vertices), rawNormals(scratch->normals), rawUV(scratch->uvs), rawTangents(scratch->tangents), rawBitangents(scratch->bitangents)
+{
+	uint32_t numVertices = _geometry.numVertices;
 
-		// Skip UV write
-		if(vertexDesc & BSTriShape::kFlag_UVs)
-		{
-			vBegin += 4;
+	triangles = _geometry.triangles;
+	numTriangles = triangles ? _geometry.numTriangles : 0;
+
+	recalcFrame = layout.hasNormals && triangles && numTriangles > 0;
+
+	sourceBlock = _geometry.vertexBlock;
+	targetBlock = dstBlock ? dstBlock : _geometry.vertexBlock;
+
+	// Pull the base data from the vertex block, meshes without UVs keep zeroed UVs so the tangent space falls back to the normals
+	rawVertices.resize(numVertices);
+	rawUV.assign(numVertices, Morpher::Vector2());
+
+	// The bitangent is spread over the W of the position, normal and tangent, so the full frame is needed whenever normals are
+	if(layout.hasNormals) {
+		rawNormals.resize(numVertices);
+		rawTangents.resize(numVertices);
+		rawBitangents.resize(numVertices);
+	}
+
+	Morpher::DecodeVertices(layout, sourceBlock, numVertices, rawVertices.data(), rawUV.data());
+
+	// Seams are found on the unmorphed positions, the caller keeps the result for the next actor using this shape
+	if(recalcFrame) {
+		if(!_topology || !_topology->Matches(numVertices, triangles, numTriangles)) {
+			std::vector<Morpher::Vector3> & weldPositions = scratch->normalSpace;
+			ToNormalSpace(rawVertices, weldPositions);
+
+			_topology = std::make_shared<Morpher::MeshTopology>();
+			_topology->Build(weldPositions.data(), numVertices, triangles, numTriangles);
 		}
+		topology = _topology;
+	}
 
-		if(vertexDesc & BSTriShape::kFlag_Normals)
-		{
-			*(SInt8*)vBegin = (UInt8)round_v((((rawNormals[i].x + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
-			*(SInt8*)vBegin = (UInt8)round_v((((rawNormals[i].y + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
-			*(SInt8*)vBegin = (UInt8)round_v((((rawNormals[i].z + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
+	// The morphs flag every vertex they move, only that area and its neighbours get a new frame
+	touched.assign(numVertices, 0);
+}
 
-			*(SInt8*)vBegin = (UInt8)round_v((((rawBitangents[i].y + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
+MorphApplicator::MorphApplicator(const Morpher::GeometryView & _geometry, uint8_t * dstBlock, Morpher::MeshTopologyPtr & _topology, std::function<void(std::vector<Morpher::Vector3> &, std::vector<uint8_t> &)> morph) : MorphApplicator(_geometry, dstBlock, _topology)
+{
+	morph(rawVertices, touched);
+	Apply();
+}
 
-			if(vertexDesc & BSTriShape::kFlag_Tangents)
-			{
-				*(SInt8*)vBegin = (UInt8)round_v((((rawTangents[i].x + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
-				*(SInt8*)vBegin = (UInt8)round_v((((rawTangents[i].y + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
-				*(SInt8*)vBegin = (UInt8)round_v((((rawTangents[i].z + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
+void MorphApplicator::Apply()
+{
+	uint32_t numVertices = rawVertices.size();
 
-				*(SInt8*)vBegin = (UInt8)round_v((((rawBitangents[i].z + 1.0f) / 2.0f) * 255.0f)); vBegin += 1;
-			}
+	if(recalcFrame) {
+		BuildRegion(touched, triangles);
+		if(!regionVertices.empty()) {
+			RecalcNormals(numTriangles, triangles);
+			CalcTangentSpace(numTriangles, triangles);
 		}
 	}
+
+	// Everything outside the region keeps the frame of the base mesh
+	if(targetBlock != sourceBlock)
+		memcpy(targetBlock, sourceBlock, (size_t)numVertices * layout.stride);
+
+	if(recalcFrame && !regionVertices.empty())
+		Morpher::EncodeVertices(layout, targetBlock, numVertices, rawVertices.data(), rawNormals.data(), rawTangents.data(), rawBitangents.data(), regionMask.data());
+	else
+		Morpher::EncodeVertices(layout, targetBlock, numVertices, rawVertices.data(), nullptr, nullptr, nullptr, nullptr);
 }
 
-void MorphApplicator::RecalcNormals(UInt32 numTriangles, Morpher::Triangle* triangles, const bool smooth, const float smoothThresh)
+MorphApplicator::~MorphApplicator()
 {
-	UInt32 numVertices = rawVertices.size();
+	ReleaseScratch();
+}
 
-	std::vector<Morpher::Vector3> verts(numVertices);
-	std::vector<Morpher::Vector3> norms(numVertices);
+void MorphApplicator::BuildRegion(const std::vector<uint8_t> & touched, Morpher::Triangle * triangles)
+{
+	uint32_t numVertices = rawVertices.size();
+	uint32_t numTriangles = topology->GetTriangleCount();
 
-	for (UInt32 i = 0; i < numVertices; i++)
+	// Moved vertices and everything sharing a triangle with them
+	regionMask.assign(numVertices, 0);
+	for (uint32_t i = 0; i < numVertices; i++)
 	{
-		verts[i].x = rawVertices[i].x * -0.1f;
-		verts[i].z = rawVertices[i].y * 0.1f;
-		verts[i].y = rawVertices[i].z * 0.1f;
+		if (!touched[i])
+			continue;
+
+		regionMask[i] = 1;
+		for (const uint32_t * t = topology->TrianglesBegin(i); t != topology->TrianglesEnd(i); ++t)
+		{
+			const Morpher::Triangle & tri = triangles[*t];
+			if (!IsValidTriangle(tri, numVertices))
+				continue;
+
+			regionMask[tri.p1] = 1;
+			regionMask[tri.p2] = 1;
+			regionMask[tri.p3] = 1;
+		}
 	}
 
-	// Face normals
-	Morpher::Vector3 tn;
-	for (UInt32 t = 0; t < numTriangles; t++)
+	// Seam copies are smoothed together, so a group is either recalculated as a whole or not at all
+	const Morpher::WeldGroups & welds = topology->GetWelds();
+	for (uint32_t g = 0; g < welds.GetGroupCount(); g++)
 	{
-		triangles[t].trinormal(verts, &tn);
-		norms[triangles[t].p1] += tn;
-		norms[triangles[t].p2] += tn;
-		norms[triangles[t].p3] += tn;
+		bool inRegion = false;
+		for (const uint32_t * m = welds.GroupBegin(g); m != welds.GroupEnd(g) && !inRegion; ++m)
+			inRegion = regionMask[*m] != 0;
+
+		if (inRegion) {
+			for (const uint32_t * m = welds.GroupBegin(g); m != welds.GroupEnd(g); ++m)
+				regionMask[*m] = 1;
+		}
 	}
 
-	for (auto &n : norms)
-		n.Normalize();
+	// Every triangle around a region vertex contributes to its frame
+	std::vector<uint8_t> & triangleMask = scratch->triangleMask;
+	triangleMask.assign(numTriangles, 0);
+	regionVertices.clear();
+	regionTriangles.clear();
+	for (uint32_t i = 0; i < numVertices; i++)
+	{
+		if (!regionMask[i])
+			continue;
 
-	// Smooth normals
-	if (smooth) {
-		kd_matcher matcher(verts.data(), numVertices);
-		for (int i = 0; i < matcher.matches.size(); i++)
+		regionVertices.push_back(i);
+		for (const uint32_t * t = topology->TrianglesBegin(i); t != topology->TrianglesEnd(i); ++t)
 		{
-			std::pair<Morpher::Vector3*, int>& a = matcher.matches[i].first;
-			std::pair<Morpher::Vector3*, int>& b = matcher.matches[i].second;
-
-			Morpher::Vector3& an = norms[a.second];
-			Morpher::Vector3& bn = norms[b.second];
-			if (an.angle(bn) < smoothThresh * DEG2RAD) {
-				Morpher::Vector3 anT = an;
-				an += bn;
-				bn += anT;
+			if (!triangleMask[*t]) {
+				triangleMask[*t] = 1;
+				regionTriangles.push_back(*t);
 			}
 		}
-
-		for (auto &n : norms)
-			n.Normalize();
 	}
+}
+
+void MorphApplicator::RecalcNormals(uint32_t numTriangles, Morpher::Triangle* triangles, const bool smooth, const float smoothThresh)
+{
+	uint32_t numVertices = rawVertices.size();
+
+	std::vector<Morpher::Vector3> & verts = scratch->normalSpace;
+	std::vector<Morpher::Vector3> & norms = scratch->vertexNormals;
+	std::vector<Morpher::Vector3> & faceNormals = scratch->triangleNormals;
+	norms.resize(numVertices);
+	faceNormals.resize(numTriangles);
+
+	ToNormalSpace(rawVertices, verts);
+
+	// Face normals
+	ForEachItem(regionTriangles, [&](uint32_t t)
+	{
+		if (IsValidTriangle(triangles[t], numVertices))
+			triangles[t].trinormal(verts, &faceNormals[t]);
+		else
+			faceNormals[t].Zero();
+	});
+
+	// Gather per vertex, triangles come in ascending order so the sums match a scatter over the triangle list
+	ForEachItem(regionVertices, [&](uint32_t i)
+	{
+		norms[i].Zero();
+		for (const uint32_t * t = topology->TrianglesBegin(i); t != topology->TrianglesEnd(i); ++t)
+			norms[i] += faceNormals[*t];
+		norms[i].Normalize();
+	});
+
+	// Smooth normals across seams, the weld groups come with the cached topology
+	if (smooth)
+		Morpher::SmoothWeldedNormals(topology->GetWelds(), norms.data(), smoothThresh, regionMask.data());
 
-	for (UInt32 i = 0; i < numVertices; i++)
+	ForEachItem(regionVertices, [&](uint32_t i)
 	{
+		if (smooth)
+			norms[i].Normalize();
+
 		rawNormals[i].x = -norms[i].x;
 		rawNormals[i].y = norms[i].z;
 		rawNormals[i].z = norms[i].y;
-	}
+	});
 }
 
-void MorphApplicator::CalcTangentSpace(UInt32 numTriangles, Morpher::Triangle * triangles)
+void MorphApplicator::CalcTangentSpace(uint32_t numTriangles, Morpher::Triangle * triangles)
 {
-	UInt32 numVertices = rawVertices.size();
+	uint32_t numVertices = rawVertices.size();
 
-	std::vector<Morpher::Vector3> tan1;
-	std::vector<Morpher::Vector3> tan2;
-	tan1.resize(numVertices);
-	tan2.resize(numVertices);
+	std::vector<Morpher::Vector3> & triTangents = scratch->triangleTangents;
+	std::vector<Morpher::Vector3> & triBitangents = scratch->triangleBitangents;
+	triTangents.resize(numTriangles);
+	triBitangents.resize(numTriangles);
 
-	for (UInt32 i = 0; i < numTriangles; i++)
+	ForEachItem(regionTriangles, [&](uint32_t i)
 	{
+		if (!IsValidTriangle(triangles[i], numVertices)) {
+			triTangents[i].Zero();
+			triBitangents[i].Zero();
+			return;
+		}
+
 		int i1 = triangles[i].p1;
 		int i2 = triangles[i].p2;
 		int i3 = triangles[i].p3;
@@ -218,19 +354,19 @@ void MorphApplicator::CalcTangentSpace(UInt32 numTriangles, Morpher::Triangle *
 		sdir.Normalize();
 		tdir.Normalize();
 
-		tan1[i1] += tdir;
-		tan1[i2] += tdir;
-		tan1[i3] += tdir;
+		triTangents[i] = tdir;
+		triBitangents[i] = sdir;
+	});
 
-		tan2[i1] += sdir;
-		tan2[i2] += sdir;
-		tan2[i3] += sdir;
-	}
-
-	for (UInt32 i = 0; i < numVertices; i++)
+	ForEachItem(regionVertices, [&](uint32_t i)
 	{
-		rawTangents[i] = tan1[i];
-		rawBitangents[i] = tan2[i];
+		rawTangents[i] = Morpher::Vector3();
+		rawBitangents[i] = Morpher::Vector3();
+		for (const uint32_t * t = topology->TrianglesBegin(i); t != topology->TrianglesEnd(i); ++t)
+		{
+			rawTangents[i] += triTangents[*t];
+			rawBitangents[i] += triBitangents[*t];
+		}
 
 		if (rawTangents[i].IsZero() || rawBitangents[i].IsZero())
 		{
@@ -252,5 +388,5 @@ void MorphApplicator::CalcTangentSpace(UInt32 numTriangles, Morpher::Triangle *
 
 			rawBitangents[i].Normalize();
 		}
-	}
+	});
 }
\ No newline at end of file
@@ -93,6 +93,17 @@ namespace papyrusBodyGen
 		g_bodyMorphInterface.UpdateMorphs(actor);
 	}
 
+	VMArray<BSFixedString> GetCacheStats(StaticFunctionTag*)
+	{
+		std::vector<std::string> lines;
+		g_bodyMorphInterface.FormatCacheStats(lines);
+
+		std::vector<BSFixedString> result;
+		for(auto & line : lines)
+			result.push_back(BSFixedString(line.c_str()));
+		return VMArray<BSFixedString>(result);
+	}
+
 	bool SetSkinOverride(StaticFunctionTag*, Actor * actor, BSFixedString id)
 	{
 		if(!actor)
@@ -167,4 +178,7 @@ void papyrusBodyGen::RegisterFuncs(VirtualMachine* vm)
 
 	vm->RegisterFunction(
 		new NativeFunction1<StaticFunctionTag, bool, Actor*>("RemoveSkinOverride", "BodyGen", papyrusBodyGen::RemoveSkinOverride, vm));
+
+	vm->RegisterFunction(
+		new NativeFunction0<StaticFunctionTag, VMArray<BSFixedString>>("GetCacheStats", "BodyGen", papyrusBodyGen::GetCacheStats, vm));
 }
\ No newline at end of file
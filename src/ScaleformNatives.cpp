@@ -227,6 +227,40 @@ void F4EEScaleform_UpdateBodyMorphs::Invoke(Args * args)
 	}
 }
 
+void F4EEScaleform_GetMorphCacheStats::Invoke(Args * args)
+{
+	MorphCacheStats stats;
+	g_bodyMorphInterface.GetCacheStats(stats, 10);
+
+	// Numbers are doubles, the byte counts can exceed 32 bits
+	args->movie->movieRoot->CreateObject(args->result);
+	Register<double>(args->result, "count", (double)stats.count);
+	Register<double>(args->result, "resident", (double)stats.resident);
+	Register<double>(args->result, "overhead", (double)stats.overhead);
+	Register<double>(args->result, "limit", (double)stats.limit);
+	Register<double>(args->result, "hits", (double)stats.hits);
+	Register<double>(args->result, "misses", (double)stats.misses);
+	Register<double>(args->result, "loads", (double)stats.loads);
+	Register<double>(args->result, "failures", (double)stats.failures);
+	Register<double>(args->result, "evictions", (double)stats.evictions);
+	Register<double>(args->result, "bytesLoaded", (double)stats.bytesLoaded);
+	Register<double>(args->result, "loadTime50", stats.loadTime[0]);
+	Register<double>(args->result, "loadTime90", stats.loadTime[1]);
+	Register<double>(args->result, "loadTime99", stats.loadTime[2]);
+
+	GFxValue largest;
+	args->movie->movieRoot->CreateArray(&largest);
+	for(auto & entry : stats.largest)
+	{
+		GFxValue fileInfo;
+		args->movie->movieRoot->CreateObject(&fileInfo);
+		RegisterString(&fileInfo, args->movie->movieRoot, "path", entry.first.c_str());
+		Register<double>(&fileInfo, "size", (double)entry.second);
+		largest.PushBack(&fileInfo);
+	}
+	args->result->SetMember("largest", &largest);
+}
+
 #include <Shlwapi.h>
 #include <functional>
 
@@ -0,0 +1,486 @@
+#include "TriArena.h"
+#include "TriReader.h"
+#include "StringHash.h"
+
+#include <string>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace Morpher
+{
+	namespace
+	{
+		enum
+		{
+			kCacheMagic = 0x4D453446,	// 'F4EM'
+			kCacheVersion = 2,
+			kCachePacked = 1,
+			kCacheQuantized = 2,
+		};
+
+		struct CacheHeader
+		{
+			uint32_t	magic;
+			uint32_t	version;
+			uint64_t	sourceSize;
+			uint64_t	sourceTime;
+			uint64_t	sourceHash;
+			uint32_t	flags;
+			uint32_t	numShapes;
+			uint32_t	numMorphs;
+			uint32_t	numDeltas;
+			uint64_t	blockSize;
+			uint32_t	deltaSize;
+			float		quantizationError;
+		};
+		static_assert(sizeof(CacheHeader) == 64, "CacheHeader keeps the block 8 byte aligned");
+
+		struct PendingMorph
+		{
+			std::string	name;
+			uint64_t	hash;
+			float		multiplier;
+			uint32_t	numDeltas;
+			size_t		offset;		// Where the deltas start in the file
+		};
+
+		struct PendingShape
+		{
+			std::string	name;
+			uint64_t	hash;
+			uint32_t	firstMorph;
+			uint32_t	numMorphs;
+		};
+
+		// Indices of the entries sorted by hash, dropping later entries whose name was already seen
+		template<typename T>
+		void SortUnique(const T * entries, uint32_t count, std::vector<uint32_t> & order)
+		{
+			order.resize(count);
+			for(uint32_t i = 0; i < count; i++)
+				order[i] = i;
+
+			std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+			{
+				return entries[a].hash < entries[b].hash;
+			});
+
+			size_t kept = 0;
+			for(size_t i = 0; i < order.size(); i++)
+			{
+				const T & entry = entries[order[i]];
+
+				bool duplicate = false;
+				for(size_t k = kept; k > 0 && entries[order[k - 1]].hash == entry.hash && !duplicate; k--)
+				{
+					const T & other = entries[order[k - 1]];
+					duplicate = EqualLower(other.name.c_str(), entry.name.c_str(), entry.name.size());
+				}
+
+				if(!duplicate)
+					order[kept++] = order[i];
+			}
+			order.resize(kept);
+		}
+
+		// Nearest step, halves away from zero, without a branch on the sign since that is random for deltas
+		int16_t QuantizeValue(float value, float multiplier)
+		{
+			float steps = (std::max)(-32767.0f, (std::min)(32767.0f, value / multiplier));
+			return (int16_t)(steps + std::copysign(0.5f, steps));
+		}
+
+		template<typename T>
+		void ComputeBounds(const T * deltas, uint32_t count, float multiplier, TriArena::Bounds & bounds)
+		{
+			if(!count) {
+				memset(&bounds, 0, sizeof(bounds));
+				return;
+			}
+
+			float lower[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+			float upper[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			float longest = 0.0f;
+			for(uint32_t k = 0; k < count; k++)
+			{
+				float x = (float)deltas[k].x, y = (float)deltas[k].y, z = (float)deltas[k].z;
+				lower[0] = x < lower[0] ? x : lower[0]; upper[0] = x > upper[0] ? x : upper[0];
+				lower[1] = y < lower[1] ? y : lower[1]; upper[1] = y > upper[1] ? y : upper[1];
+				lower[2] = z < lower[2] ? z : lower[2]; upper[2] = z > upper[2] ? z : upper[2];
+				float length = x * x + y * y + z * z;
+				longest = length > longest ? length : longest;
+			}
+			bounds.maxDisplacement = std::sqrt(longest) * std::fabs(multiplier);
+
+			// The multiplier is positive in practice, a negative one flips the box
+			for(int i = 0; i < 3; i++)
+			{
+				float a = lower[i] * multiplier, b = upper[i] * multiplier;
+				bounds.min[i] = (std::min)(a, b);
+				bounds.max[i] = (std::max)(a, b);
+			}
+		}
+	}
+
+	void TriArena::Clear()
+	{
+		m_packed = false;
+		m_quantized = false;
+		m_deltasReleased = false;
+		m_quantizationError = 0.0f;
+		m_numShapes = 0;
+		m_numMorphs = 0;
+		m_numDeltas = 0;
+		m_data = nullptr;
+		m_size = 0;
+		m_block.clear();
+		m_block.shrink_to_fit();
+		m_owner.reset();
+	}
+
+	bool TriArena::Parse(const uint8_t * data, size_t size)
+	{
+		Clear();
+		m_error = nullptr;
+		m_errorOffset = 0;
+
+		TriReader reader(data, size);
+		auto fail = [&]()
+		{
+			return Fail(reader.GetError(), reader.GetOffset());
+		};
+
+		if(!reader.ReadHeader())
+			return fail();
+
+		// First pass only walks the directory, the deltas are skipped and copied once their place is known
+		std::vector<PendingShape> shapes(reader.GetShapeCount());
+		std::vector<PendingMorph> morphs;
+		for(auto & shape : shapes)
+		{
+			if(!reader.ReadShape(shape.name, shape.numMorphs))
+				return fail();
+
+			shape.hash = HashLower(shape.name.c_str(), shape.name.size());
+			shape.firstMorph = (uint32_t)morphs.size();
+			morphs.resize(morphs.size() + shape.numMorphs);
+
+			for(uint32_t m = 0; m < shape.numMorphs; m++)
+			{
+				PendingMorph & morph = morphs[shape.firstMorph + m];
+				if(!reader.ReadMorph(morph.name, morph.multiplier, morph.numDeltas))
+					return fail();
+
+				morph.hash = HashLower(morph.name.c_str(), morph.name.size());
+				morph.offset = reader.GetOffset();
+				if(!reader.Seek(morph.offset + morph.numDeltas * TriReader::GetDeltaSize(reader.IsPacked())))
+					return fail();
+			}
+		}
+
+		std::vector<uint32_t> shapeOrder;
+		SortUnique(shapes.data(), (uint32_t)shapes.size(), shapeOrder);
+
+		std::vector<std::vector<uint32_t>> morphOrders(shapeOrder.size());
+		size_t numMorphs = 0, numDeltas = 0, nameBytes = 0;
+		for(size_t s = 0; s < shapeOrder.size(); s++)
+		{
+			const PendingShape & shape = shapes[shapeOrder[s]];
+			SortUnique(morphs.data() + shape.firstMorph, shape.numMorphs, morphOrders[s]);
+
+			nameBytes += shape.name.size() + 1;
+			numMorphs += morphOrders[s].size();
+			for(uint32_t m : morphOrders[s])
+			{
+				const PendingMorph & morph = morphs[shape.firstMorph + m];
+				numDeltas += morph.numDeltas;
+				nameBytes += morph.name.size() + 1;
+			}
+		}
+
+		if(numDeltas > UINT32_MAX || nameBytes > UINT32_MAX)
+			return Fail("too many deltas");
+
+		m_packed = reader.IsPacked();
+		m_numShapes = (uint32_t)shapeOrder.size();
+		m_numMorphs = (uint32_t)numMorphs;
+		m_numDeltas = (uint32_t)numDeltas;
+		m_block.resize(NamesOffset() + nameBytes);
+		m_data = m_block.data();
+		m_size = m_block.size();
+
+		Shape * outShapes = (Shape *)m_block.data();
+		Morph * outMorphs = (Morph *)(m_block.data() + MorphsOffset());
+		Bounds * outBounds = (Bounds *)(m_block.data() + BoundsOffset());
+		uint8_t * outDeltas = m_block.data() + DeltasOffset();
+		char * outNames = (char *)m_block.data() + NamesOffset();
+
+		uint32_t morphIndex = 0, deltaIndex = 0, nameOffset = 0;
+		auto addName = [&](const std::string & name)
+		{
+			uint32_t offset = nameOffset;
+			memcpy(outNames + offset, name.c_str(), name.size() + 1);
+			nameOffset += (uint32_t)name.size() + 1;
+			return offset;
+		};
+
+		for(size_t s = 0; s < shapeOrder.size(); s++)
+		{
+			const PendingShape & shape = shapes[shapeOrder[s]];
+
+			Shape & outShape = outShapes[s];
+			outShape.hash = shape.hash;
+			outShape.name = addName(shape.name);
+			outShape.firstMorph = morphIndex;
+			outShape.numMorphs = (uint32_t)morphOrders[s].size();
+			outShape.reserved = 0;
+
+			for(uint32_t m : morphOrders[s])
+			{
+				const PendingMorph & morph = morphs[shape.firstMorph + m];
+
+				Morph & outMorph = outMorphs[morphIndex++];
+				outMorph.hash = morph.hash;
+				outMorph.name = addName(morph.name);
+				outMorph.firstDelta = deltaIndex;
+				outMorph.numDeltas = morph.numDeltas;
+				outMorph.multiplier = morph.multiplier;
+
+				bool success = reader.Seek(morph.offset);
+				if(m_packed)
+					success = success && reader.ReadDeltas((TriPackedVertexDelta *)outDeltas + deltaIndex, morph.numDeltas);
+				else
+					success = success && reader.ReadDeltas((TriVertexDelta *)outDeltas + deltaIndex, morph.numDeltas);
+				if(!success)
+					return fail();
+
+				Bounds & bounds = outBounds[morphIndex - 1];
+				if(m_packed)
+					ComputeBounds((TriPackedVertexDelta *)outDeltas + deltaIndex, morph.numDeltas, morph.multiplier, bounds);
+				else
+					ComputeBounds((TriVertexDelta *)outDeltas + deltaIndex, morph.numDeltas, 1.0f, bounds);
+
+				deltaIndex += morph.numDeltas;
+			}
+		}
+
+		return true;
+	}
+
+	void TriArena::Save(const SourceKey & key, std::vector<uint8_t> & out) const
+	{
+		out.clear();
+		if(m_deltasReleased)
+			return;
+
+		CacheHeader header;
+		header.magic = kCacheMagic;
+		header.version = kCacheVersion;
+		header.sourceSize = key.size;
+		header.sourceTime = key.time;
+		header.sourceHash = key.hash;
+		header.flags = (m_packed ? kCachePacked : 0) | (m_quantized ? kCacheQuantized : 0);
+		header.numShapes = m_numShapes;
+		header.numMorphs = m_numMorphs;
+		header.numDeltas = m_numDeltas;
+		header.blockSize = m_size;
+		header.deltaSize = (uint32_t)DeltaSize();
+		header.quantizationError = m_quantizationError;
+
+		out.resize(sizeof(CacheHeader) + m_size);
+		memcpy(out.data(), &header, sizeof(CacheHeader));
+		if(m_size)
+			memcpy(out.data() + sizeof(CacheHeader), m_data, m_size);
+	}
+
+	bool TriArena::Load(const uint8_t * data, size_t size, const SourceKey & key, const std::shared_ptr<const void> & owner)
+	{
+		Clear();
+		m_error = nullptr;
+		m_errorOffset = 0;
+
+		CacheHeader header;
+		if(size < sizeof(CacheHeader))
+			return Fail("unexpected end of file");
+
+		memcpy(&header, data, sizeof(CacheHeader));
+		if(header.magic != kCacheMagic || header.version != kCacheVersion)
+			return Fail("unknown file format");
+
+		SourceKey cachedKey;
+		cachedKey.size = header.sourceSize;
+		cachedKey.time = header.sourceTime;
+		cachedKey.hash = header.sourceHash;
+		if(!(cachedKey == key))
+			return Fail("source changed");
+
+		const uint8_t * block = data + sizeof(CacheHeader);
+		if(header.blockSize != size - sizeof(CacheHeader) || ((uintptr_t)block & 7) != 0)
+			return Fail("bad block size");
+
+		m_packed = (header.flags & kCachePacked) != 0;
+		m_quantized = m_packed && (header.flags & kCacheQuantized) != 0;
+		m_quantizationError = header.quantizationError;
+		m_numShapes = header.numShapes;
+		m_numMorphs = header.numMorphs;
+		m_numDeltas = header.numDeltas;
+		if(header.deltaSize != DeltaSize())
+			return Fail("bad delta size");
+
+		// Everything the lookups and MorphMatrix::Build index with has to stay inside the block
+		uint64_t namesOffset = (uint64_t)m_numShapes * sizeof(Shape) + (uint64_t)m_numMorphs * (sizeof(Morph) + sizeof(Bounds)) + (uint64_t)m_numDeltas * DeltaSize();
+		if(namesOffset > header.blockSize)
+			return Fail("bad counts");
+
+		uint64_t namesSize = header.blockSize - namesOffset;
+		if(namesSize && block[header.blockSize - 1] != 0)
+			return Fail("bad names");
+
+		const Shape * shapes = (const Shape *)block;
+		for(uint32_t i = 0; i < m_numShapes; i++)
+		{
+			if(shapes[i].name >= namesSize || (uint64_t)shapes[i].firstMorph + shapes[i].numMorphs > m_numMorphs)
+				return Fail("bad shape", sizeof(CacheHeader) + i * sizeof(Shape));
+		}
+
+		const Morph * morphs = (const Morph *)(block + MorphsOffset());
+		for(uint32_t i = 0; i < m_numMorphs; i++)
+		{
+			if(morphs[i].name >= namesSize || (uint64_t)morphs[i].firstDelta + morphs[i].numDeltas > m_numDeltas || morphs[i].numDeltas > TriReader::kMaxMorphVertices)
+				return Fail("bad morph", sizeof(CacheHeader) + MorphsOffset() + i * sizeof(Morph));
+		}
+
+		m_data = block;
+		m_size = (size_t)header.blockSize;
+		m_owner = owner;
+		return true;
+	}
+
+	bool TriArena::Quantize(float maxError, float & error)
+	{
+		error = 0.0f;
+		if(m_packed || m_deltasReleased)
+			return false;
+
+		// Every morph gets the step that spreads its largest delta over the full 16 bits, converted aside before anything is changed
+		const Morph * morphs = GetMorphs();
+		std::vector<float> multipliers(m_numMorphs);
+		std::vector<TriPackedVertexDelta> packedDeltas(m_numDeltas);
+		for(uint32_t m = 0; m < m_numMorphs; m++)
+		{
+			const TriVertexDelta * deltas = GetDeltas(morphs[m]);
+			float largest = 0.0f;
+			for(uint32_t k = 0; k < morphs[m].numDeltas; k++)
+				largest = (std::max)(largest, (std::max)(std::fabs(deltas[k].x), (std::max)(std::fabs(deltas[k].y), std::fabs(deltas[k].z))));
+
+			float multiplier = largest > 0.0f ? largest / 32767.0f : 1.0f;
+			TriPackedVertexDelta * packed = &packedDeltas[morphs[m].firstDelta];
+			for(uint32_t k = 0; k < morphs[m].numDeltas; k++)
+			{
+				packed[k].index = deltas[k].index;
+				packed[k].x = QuantizeValue(deltas[k].x, multiplier);
+				packed[k].y = QuantizeValue(deltas[k].y, multiplier);
+				packed[k].z = QuantizeValue(deltas[k].z, multiplier);
+				error = (std::max)(error, std::fabs((float)packed[k].x * multiplier - deltas[k].x));
+				error = (std::max)(error, std::fabs((float)packed[k].y * multiplier - deltas[k].y));
+				error = (std::max)(error, std::fabs((float)packed[k].z * multiplier - deltas[k].z));
+			}
+			multipliers[m] = multiplier;
+		}
+
+		m_quantizationError = error;
+		if(!(error <= maxError))
+			return false;
+
+		// Same layout with the smaller deltas, the names move down behind them
+		size_t namesSize = m_size - NamesOffset();
+		m_packed = true;
+
+		std::vector<uint8_t> block(NamesOffset() + namesSize);
+		memcpy(block.data(), m_data, DeltasOffset());
+		if(m_numDeltas)
+			memcpy(block.data() + DeltasOffset(), packedDeltas.data(), (size_t)m_numDeltas * sizeof(TriPackedVertexDelta));
+		memcpy(block.data() + NamesOffset(), m_data + m_size - namesSize, namesSize);
+
+		// The box is what the quantized deltas span now
+		Morph * outMorphs = (Morph *)(block.data() + MorphsOffset());
+		Bounds * outBounds = (Bounds *)(block.data() + BoundsOffset());
+		for(uint32_t m = 0; m < m_numMorphs; m++)
+		{
+			outMorphs[m].multiplier = multipliers[m];
+			ComputeBounds(&packedDeltas[outMorphs[m].firstDelta], outMorphs[m].numDeltas, multipliers[m], outBounds[m]);
+		}
+
+		m_block.swap(block);
+		m_data = m_block.data();
+		m_size = m_block.size();
+		m_owner.reset();
+		m_quantized = true;
+		return true;
+	}
+
+	void TriArena::ReleaseDeltas()
+	{
+		if(m_deltasReleased || !m_data)
+			return;
+
+		size_t namesSize = m_size - NamesOffset();
+		std::vector<uint8_t> block(DeltasOffset() + namesSize);
+		memcpy(block.data(), m_data, DeltasOffset());
+		memcpy(block.data() + DeltasOffset(), m_data + m_size - namesSize, namesSize);
+
+		m_block.swap(block);
+		m_data = m_block.data();
+		m_size = m_block.size();
+		m_owner.reset();
+		m_deltasReleased = true;
+	}
+
+	uint64_t TriArena::HashSource(const uint8_t * data, size_t size)
+	{
+		// FNV-1a over 8 byte words, then the tail
+		const uint64_t prime = 1099511628211ULL;
+		uint64_t hash = 14695981039346656037ULL ^ size;
+
+		size_t i = 0;
+		for(; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(word));
+			hash = (hash ^ word) * prime;
+		}
+		for(; i < size; i++)
+			hash = (hash ^ data[i]) * prime;
+
+		return hash;
+	}
+
+	const TriArena::Shape * TriArena::FindShape(const char * name, size_t length, uint64_t hash) const
+	{
+		const Shape * end = GetShapes() + m_numShapes;
+		const Shape * it = std::lower_bound(GetShapes(), end, hash, [](const Shape & shape, uint64_t value) { return shape.hash < value; });
+		for(; it != end && it->hash == hash; ++it)
+		{
+			if(EqualLower(GetName(it->name), name, length))
+				return it;
+		}
+
+		return nullptr;
+	}
+
+	const TriArena::Morph * TriArena::FindMorph(const Shape & shape, const char * name, size_t length, uint64_t hash) const
+	{
+		const Morph * begin = GetMorphs() + shape.firstMorph;
+		const Morph * end = begin + shape.numMorphs;
+		const Morph * it = std::lower_bound(begin, end, hash, [](const Morph & morph, uint64_t value) { return morph.hash < value; });
+		for(; it != end && it->hash == hash; ++it)
+		{
+			if(EqualLower(GetName(it->name), name, length))
+				return it;
+		}
+
+		return nullptr;
+	}
+}
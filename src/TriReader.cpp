@@ -0,0 +1,143 @@
+#include "TriReader.h"
+
+#include <cstring>
+
+namespace Morpher
+{
+	template<typename T>
+	bool TriReader::Read(T & value)
+	{
+		if(!Has(sizeof(T)))
+			return Fail("unexpected end of file");
+
+		memcpy(&value, m_data + m_offset, sizeof(T));
+		m_offset += sizeof(T);
+		return true;
+	}
+
+	bool TriReader::ReadName(std::string & name)
+	{
+		uint8_t length = 0;
+		if(!Read(length))
+			return false;
+		if(!Has(length))
+			return Fail("unexpected end of file");
+
+		// Names are fixed length fields, anything past an embedded terminator is dropped
+		const char * begin = (const char *)m_data + m_offset;
+		const void * terminator = memchr(begin, 0, length);
+		name.assign(begin, terminator ? (const char *)terminator - begin : length);
+		m_offset += length;
+		return true;
+	}
+
+	bool TriReader::ReadCount(uint32_t & count)
+	{
+		if(m_packed) {
+			uint16_t packedCount = 0;
+			if(!Read(packedCount))
+				return false;
+			count = packedCount;
+			return true;
+		}
+
+		return Read(count);
+	}
+
+	bool TriReader::ReadHeader()
+	{
+		m_offset = 0;
+		m_error = nullptr;
+
+		uint32_t format = 0;
+		if(!Read(format))
+			return false;
+
+		if(format != kFormatFull && format != kFormatPacked)
+			return Fail("unknown file format");
+
+		m_packed = format == kFormatPacked;
+		return ReadCount(m_shapeCount);
+	}
+
+	bool TriReader::ReadShape(std::string & name, uint32_t & morphCount)
+	{
+		if(!ReadName(name))
+			return false;
+
+		// Full files carry the byte size of the shape block, nothing depends on it
+		if(!m_packed) {
+			uint32_t blockSize = 0;
+			if(!Read(blockSize))
+				return false;
+		}
+
+		return ReadCount(morphCount);
+	}
+
+	bool TriReader::ReadMorph(std::string & name, float & multiplier, uint32_t & vertexCount)
+	{
+		if(!ReadName(name))
+			return false;
+
+		multiplier = 0.0f;
+		if(!m_packed) {
+			uint32_t blockSize = 0;
+			if(!Read(blockSize))
+				return false;
+			if(!Read(vertexCount))
+				return false;
+		}
+		else {
+			if(!Read(multiplier))
+				return false;
+			if(!ReadCount(vertexCount))
+				return false;
+		}
+
+		if(vertexCount > kMaxMorphVertices)
+			return Fail("too many vertices");
+		if(!Has((size_t)vertexCount * GetDeltaSize(m_packed)))
+			return Fail("unexpected end of file");
+
+		return true;
+	}
+
+	bool TriReader::ReadDeltas(TriVertexDelta * deltas, uint32_t count)
+	{
+		if(m_packed)
+			return Fail("full deltas read from a packed file");
+		if(!Has((size_t)count * GetDeltaSize(false)))
+			return Fail("unexpected end of file");
+
+		const uint8_t * src = m_data + m_offset;
+		for(uint32_t i = 0; i < count; i++, src += 16)
+		{
+			uint32_t index;
+			memcpy(&index, src, sizeof(uint32_t));
+			deltas[i].index = (uint16_t)index;
+			memcpy(&deltas[i].x, src + 4, sizeof(float) * 3);
+		}
+
+		m_offset += (size_t)count * GetDeltaSize(false);
+		return true;
+	}
+
+	bool TriReader::ReadDeltas(TriPackedVertexDelta * deltas, uint32_t count)
+	{
+		if(!m_packed)
+			return Fail("packed deltas read from a full file");
+		if(!Has((size_t)count * GetDeltaSize(true)))
+			return Fail("unexpected end of file");
+
+		const uint8_t * src = m_data + m_offset;
+		for(uint32_t i = 0; i < count; i++, src += 8)
+		{
+			memcpy(&deltas[i].index, src, sizeof(uint16_t));
+			memcpy(&deltas[i].x, src + 2, sizeof(int16_t) * 3);
+		}
+
+		m_offset += (size_t)count * GetDeltaSize(true);
+		return true;
+	}
+}
@@ -83,23 +83,21 @@ void BSReadAll(BSResourceNiBinaryStream* fin, std::string* str)
 	}
 }
 
-bool VisitObjects(NiAVObject * parent, std::function<bool(NiAVObject*)> functor)
+void BSReadAll(BSResourceNiBinaryStream* fin, std::vector<UInt8>* data)
 {
-	if (functor(parent))
-		return true;
-
-	NiPointer<NiNode> node(parent->GetAsNiNode());
-	if(node) {
-		for(UInt32 i = 0; i < node->m_children.m_emptyRunStart; i++) {
-			NiPointer<NiAVObject> object(node->m_children.m_data[i]);
-			if(object) {
-				if (VisitObjects(object, functor))
-					return true;
-			}
-		}
-	}
+	const UInt32 chunkSize = 0x10000;
+	UInt32 ret = 0;
+	do {
+		size_t offset = data->size();
+		data->resize(offset + chunkSize);
+		ret = fin->Read((char*)data->data() + offset, chunkSize);
+		data->resize(offset + ret);
+	} while (ret > 0);
+}
 
-	return false;
+bool VisitObjects(NiAVObject * parent, std::function<bool(NiAVObject*)> functor)
+{
+	return VisitObjects<std::function<bool(NiAVObject*)> &>(parent, functor);
 }
 
 
@@ -0,0 +1,168 @@
+#include "VertexCodec.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "half.hpp"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define VERTEXCODEC_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Vertices staged per pass, keeps the scratch streams on the stack and inside L1
+	const uint32_t kBlockVertices = 256;
+
+	float round_v(float num)
+	{
+		return (num > 0.0) ? floor(num + 0.5) : ceil(num - 0.5);
+	}
+
+	// Maps [-1, 1] onto [0, 255], rounding half away from zero exactly like round_v does
+	void QuantizeUnit(const float * src, uint8_t * dst, uint32_t count)
+	{
+		uint32_t i = 0;
+#ifdef VERTEXCODEC_SSE
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 negHalf = _mm_set1_ps(-0.5f);
+		const __m128 scale = _mm_set1_ps(255.0f);
+		const __m128i byteMask = _mm_set1_epi32(0xFF);
+
+		for(; i + 16 <= count; i += 16)
+		{
+			__m128i q[4];
+			for(uint32_t k = 0; k < 4; k++)
+			{
+				__m128 f = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&src[i + k * 4]), one), half), scale);
+				__m128i t = _mm_cvttps_epi32(f);
+				__m128 frac = _mm_sub_ps(f, _mm_cvtepi32_ps(t));
+				t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(frac, half)));
+				t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(frac, negHalf)));
+				q[k] = _mm_and_si128(t, byteMask);
+			}
+			__m128i lo = _mm_packs_epi32(q[0], q[1]);
+			__m128i hi = _mm_packs_epi32(q[2], q[3]);
+			_mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for(; i < count; i++)
+			dst[i] = (uint8_t)round_v((((src[i] + 1.0f) / 2.0f) * 255.0f));
+	}
+}
+
+namespace Morpher
+{
+	void DecodeVertices(const VertexLayout & layout, const uint8_t * block, uint32_t numVertices, Vector3 * positions, Vector2 * uvs)
+	{
+		uint16_t halves[kBlockVertices * 4];
+		float floats[kBlockVertices * 4];
+
+		const uint32_t uvOffset = layout.UVOffset();
+
+		for(uint32_t base = 0; base < numVertices; base += kBlockVertices)
+		{
+			uint32_t count = (std::min)(kBlockVertices, numVertices - base);
+			const uint8_t * vBegin = &block[base * layout.stride];
+
+			if(layout.fullPrecision)
+			{
+				for(uint32_t i = 0; i < count; i++)
+					memcpy(&positions[base + i], &vBegin[i * layout.stride], sizeof(float) * 3);
+			}
+			else
+			{
+				// Position and bitangent X are four consecutive halves, convert them as one stream
+				for(uint32_t i = 0; i < count; i++)
+					memcpy(&halves[i * 4], &vBegin[i * layout.stride], sizeof(uint16_t) * 4);
+
+				half_float::half_to_float(halves, floats, count * 4);
+
+				for(uint32_t i = 0; i < count; i++)
+					positions[base + i] = Vector3(floats[i * 4 + 0], floats[i * 4 + 1], floats[i * 4 + 2]);
+			}
+
+			if(uvs && layout.hasUVs)
+			{
+				for(uint32_t i = 0; i < count; i++)
+					memcpy(&halves[i * 2], &vBegin[i * layout.stride + uvOffset], sizeof(uint16_t) * 2);
+
+				half_float::half_to_float(halves, (float*)&uvs[base], count * 2);
+			}
+		}
+	}
+
+	void EncodeVertices(const VertexLayout & layout, uint8_t * block, uint32_t numVertices, const Vector3 * positions, const Vector3 * normals, const Vector3 * tangents, const Vector3 * bitangents, const uint8_t * frameMask)
+	{
+		uint16_t halves[kBlockVertices * 4];
+		float floats[kBlockVertices * 8];
+		uint8_t bytes[kBlockVertices * 8];
+
+		// Without a recalculated frame the bitangent X stored next to the position is kept as is
+		const bool writeFrame = layout.hasNormals && normals && tangents && bitangents;
+		const uint32_t normalOffset = layout.NormalOffset();
+		const uint32_t frameSize = layout.hasTangents ? 8 : 4;
+
+		for(uint32_t base = 0; base < numVertices; base += kBlockVertices)
+		{
+			uint32_t count = (std::min)(kBlockVertices, numVertices - base);
+			uint8_t * vBegin = &block[base * layout.stride];
+
+			if(layout.fullPrecision)
+			{
+				for(uint32_t i = 0; i < count; i++)
+				{
+					memcpy(&vBegin[i * layout.stride], &positions[base + i], sizeof(float) * 3);
+					if(writeFrame && (!frameMask || frameMask[base + i]))
+						memcpy(&vBegin[i * layout.stride + 12], &bitangents[base + i].x, sizeof(float));
+				}
+			}
+			else
+			{
+				for(uint32_t i = 0; i < count; i++)
+				{
+					floats[i * 4 + 0] = positions[base + i].x;
+					floats[i * 4 + 1] = positions[base + i].y;
+					floats[i * 4 + 2] = positions[base + i].z;
+					floats[i * 4 + 3] = writeFrame ? bitangents[base + i].x : 0.0f;
+				}
+
+				half_float::float_to_half(floats, halves, count * 4);
+
+				for(uint32_t i = 0; i < count; i++)
+				{
+					const bool vertexFrame = writeFrame && (!frameMask || frameMask[base + i]);
+					memcpy(&vBegin[i * layout.stride], &halves[i * 4], sizeof(uint16_t) * (vertexFrame ? 4 : 3));
+				}
+			}
+
+			if(writeFrame)
+			{
+				// Normal carries bitangent Y in its W, tangent carries bitangent Z
+				for(uint32_t i = 0; i < count; i++)
+				{
+					float * frame = &floats[i * 8];
+					frame[0] = normals[base + i].x;
+					frame[1] = normals[base + i].y;
+					frame[2] = normals[base + i].z;
+					frame[3] = bitangents[base + i].y;
+					frame[4] = tangents[base + i].x;
+					frame[5] = tangents[base + i].y;
+					frame[6] = tangents[base + i].z;
+					frame[7] = bitangents[base + i].z;
+				}
+
+				QuantizeUnit(floats, bytes, count * 8);
+
+				for(uint32_t i = 0; i < count; i++)
+				{
+					if(!frameMask || frameMask[base + i])
+						memcpy(&vBegin[i * layout.stride + normalOffset], &bytes[i * 8], frameSize);
+				}
+			}
+		}
+	}
+}
@@ -17,6 +17,8 @@
 #include "ActorUpdateManager.h"
 #include "SkinInterface.h"
 #include "Utilities.h"
+#include "Morpher.h"
+#include "MorphMatrix.h"
 
 #include "PapyrusBodyGen.h"
 #include "PapyrusOverlays.h"
@@ -65,6 +67,15 @@ bool g_bEnableBodyMorphs = true;
 bool g_bEnableOverlays = true;
 bool g_bEnableSkinOverrides = true;
 bool g_bParallelShapes = false;
+UInt32 g_uParallelVertexThreshold = 8192;
+bool g_bEnableMorphCache = false;
+bool g_bQuantizeMorphs = false;
+float g_fMorphQuantizationError = 0.001f;
+float g_fMinMorphDisplacement = 0.05f;
+UInt32 g_uTriLoaderThreads = 2;
+bool g_bCacheMaintenance = true;
+float g_fCacheLowWater = 0.9f;
+UInt32 g_uCacheIdleMinutes = 0;
 bool g_bEnableTintExtensions = true;
 bool g_bIgnoreTintPalettes = false;
 bool g_bIgnoreTintTextures = false;
@@ -227,8 +238,12 @@ void F4SEMessageHandler(F4SEMessagingInterface::Message* msg)
 		break;
 	case F4SEMessagingInterface::kMessage_GameLoaded:
 		{
-			if(g_bEnableModelPreprocessor)
+			if(g_bEnableModelPreprocessor) {
+				g_bodyMorphInterface.StartLoaders(g_uTriLoaderThreads);
 				g_bodyMorphInterface.SetModelProcessor();
+			}
+			if(g_bCacheMaintenance)
+				g_bodyMorphInterface.StartMaintenance(g_fCacheLowWater, g_uCacheIdleMinutes);
 
 #if _TRANSFORMS
 			g_transformInterface.SetModelProcessor();
@@ -439,6 +454,7 @@ bool ScaleformCallback(GFxMovieView * view, GFxValue * value)
 	RegisterFunction<F4EEScaleform_SetBodyMorph>(value, view->movieRoot, "SetBodyMorph");
 	RegisterFunction<F4EEScaleform_UpdateBodyMorphs>(value, view->movieRoot, "UpdateBodyMorphs");
 	RegisterFunction<F4EEScaleform_CloneBodyMorphs>(value, view->movieRoot, "CloneBodyMorphs");
+	RegisterFunction<F4EEScaleform_GetMorphCacheStats>(value, view->movieRoot, "GetMorphCacheStats");
 
 	RegisterFunction<F4EEScaleform_GetOverlays>(value, view->movieRoot, "GetOverlays");
 	RegisterFunction<F4EEScaleform_GetOverlayTemplates>(value, view->movieRoot, "GetOverlayTemplates");
@@ -583,7 +599,43 @@ DLLEXPORT bool F4SEPlugin_Load(const F4SEInterface * skse)
 	{
 		g_bodyMorphInterface.SetCacheLimit(uMaxCache);
 	}
+	UInt64 uMaxGeometryCache;
+	if(F4EEGetConfigValue("BodyMorph", "uMaxGeometryCache", &uMaxGeometryCache))
+	{
+		g_bodyMorphInterface.SetGeometryCacheLimit(uMaxGeometryCache);
+	}
 	F4EEGetConfigValue("BodyMorph", "bParallelShapes", &g_bParallelShapes);
+	F4EEGetConfigValue("BodyMorph", "uParallelVertexThreshold", &g_uParallelVertexThreshold);
+	Morpher::SetParallelVertexThreshold(g_uParallelVertexThreshold);
+	float fDenseMorphDensity = Morpher::GetDenseMorphDensity();
+	if(F4EEGetConfigValue("BodyMorph", "fDenseMorphDensity", &fDenseMorphDensity))
+		Morpher::SetDenseMorphDensity(fDenseMorphDensity);
+	F4EEGetConfigValue("BodyMorph", "bEnableMorphCache", &g_bEnableMorphCache);
+	F4EEGetConfigValue("BodyMorph", "bQuantizeMorphs", &g_bQuantizeMorphs);
+	F4EEGetConfigValue("BodyMorph", "fMorphQuantizationError", &g_fMorphQuantizationError);
+	F4EEGetConfigValue("BodyMorph", "fMinMorphDisplacement", &g_fMinMorphDisplacement);
+	F4EEGetConfigValue("BodyMorph", "uTriLoaderThreads", &g_uTriLoaderThreads);
+	F4EEGetConfigValue("BodyMorph", "bCacheMaintenance", &g_bCacheMaintenance);
+	F4EEGetConfigValue("BodyMorph", "fCacheLowWater", &g_fCacheLowWater);
+	F4EEGetConfigValue("BodyMorph", "uCacheIdleMinutes", &g_uCacheIdleMinutes);
+
+	UInt32 uMorphCacheStatsInterval = 300;
+	F4EEGetConfigValue("BodyMorph", "uMorphCacheStatsInterval", &uMorphCacheStatsInterval);
+	g_bodyMorphInterface.SetCacheStatsInterval(uMorphCacheStatsInterval);
+
+	std::string strMorphCachePolicy = F4EEGetConfigOption("BodyMorph", "strMorphCachePolicy");
+	Morpher::CachePolicy morphCachePolicy;
+	if(!strMorphCachePolicy.empty()) {
+		if(Morpher::ParseCachePolicy(strMorphCachePolicy.c_str(), morphCachePolicy))
+			g_bodyMorphInterface.SetCachePolicy(morphCachePolicy);
+		else
+			_WARNING("Unknown morph cache policy %s, expected lru, lfu or gds", strMorphCachePolicy.c_str());
+	}
+
+	bool bRecordMorphCacheTrace = false;
+	F4EEGetConfigValue("BodyMorph", "bRecordMorphCacheTrace", &bRecordMorphCacheTrace);
+	if(bRecordMorphCacheTrace)
+		g_bodyMorphInterface.StartCacheTrace("Data\\F4SE\\Plugins\\F4EE\\MorphCache.trace");
 
 	F4EEGetConfigValue("CharGen", "bEnableTintExtensions", &g_bEnableTintExtensions);
 	F4EEGetConfigValue("CharGen", "bUnlockHeadParts", &g_bUnlockHeadParts);
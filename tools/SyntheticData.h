@@ -0,0 +1,268 @@
+#pragma once
+
+// Reproducible inputs shared by the standalone tools, generated from fixed seeds so runs on different machines see the same data
+
+#include "Morpher.h"
+#include "MeshDump.h"
+#include "MorphDeltas.h"
+#include "TriReader.h"
+#include "half.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace Synthetic
+{
+	// Only the raw engine output of mt19937 is specified by the standard, the distributions are not, so scaling is done here
+	class Random
+	{
+	public:
+		Random(uint32_t seed) : m_engine(seed) { }
+
+		uint32_t Next(uint32_t range) { return (uint32_t)(m_engine() % range); }
+		float Next(float lower, float upper) { return lower + (upper - lower) * (float)(m_engine() >> 8) * (1.0f / 16777216.0f); }
+
+	protected:
+		std::mt19937 m_engine;
+	};
+
+	// Deltas with the multiplier already applied
+	struct Morph
+	{
+		std::string							name;
+		std::vector<Morpher::TriVertexDelta>	deltas;
+	};
+
+	struct Shape
+	{
+		std::string			name;
+		std::vector<Morph>	morphs;
+	};
+
+	// Cylinder with a UV seam down one side, the seam column is duplicated so it has to be welded like in game meshes
+	inline bool BuildCylinder(uint32_t columns, uint32_t rows, bool fullPrecision, Morpher::MeshDump & mesh)
+	{
+		if(columns < 3 || rows < 2 || (uint64_t)(columns + 1) * rows > 0xFFFF)
+			return false;
+
+		Morpher::VertexLayout & layout = mesh.layout;
+		layout.fullPrecision = fullPrecision;
+		layout.hasUVs = true;
+		layout.hasNormals = true;
+		layout.hasTangents = true;
+		layout.stride = layout.TangentOffset() + 4;
+
+		uint32_t rowVertices = columns + 1;
+		mesh.numVertices = rowVertices * rows;
+		mesh.vertexBlock.assign((size_t)mesh.numVertices * layout.stride, 0);
+		mesh.triangles.clear();
+
+		std::vector<Morpher::Vector3> positions(mesh.numVertices);
+		for(uint32_t r = 0; r < rows; r++)
+		{
+			for(uint32_t c = 0; c <= columns; c++)
+			{
+				uint32_t i = r * rowVertices + c;
+				float angle = (float)(c % columns) / columns * 2.0f * PI;
+				float radius = 10.0f + 2.0f * sinf(r * 0.05f);
+				positions[i] = Morpher::Vector3(cosf(angle) * radius, sinf(angle) * radius, r * 0.5f);
+
+				half_float::half uv[2] = { half_float::half((float)c / columns), half_float::half((float)r / (rows - 1)) };
+				memcpy(&mesh.vertexBlock[(size_t)i * layout.stride + layout.UVOffset()], uv, sizeof(uv));
+			}
+		}
+
+		for(uint32_t r = 0; r + 1 < rows; r++)
+		{
+			for(uint32_t c = 0; c < columns; c++)
+			{
+				uint16_t a = (uint16_t)(r * rowVertices + c);
+				uint16_t b = (uint16_t)(a + 1);
+				uint16_t d = (uint16_t)(a + rowVertices);
+				uint16_t e = (uint16_t)(d + 1);
+				mesh.triangles.push_back(Morpher::Triangle(a, b, d));
+				mesh.triangles.push_back(Morpher::Triangle(b, e, d));
+			}
+		}
+
+		// Positions only, then one pass over every vertex gives the base mesh a consistent frame
+		Morpher::EncodeVertices(layout, mesh.vertexBlock.data(), mesh.numVertices, positions.data(), nullptr, nullptr, nullptr);
+
+		Morpher::MeshTopologyPtr topology;
+		MorphApplicator morpher(mesh.GetView(), nullptr, topology);
+		std::fill(morpher.GetTouched().begin(), morpher.GetTouched().end(), 1);
+		morpher.Apply();
+		return true;
+	}
+
+	// Clustered like real sliders, every morph moves a band of neighbouring vertices
+	inline void BuildMorphs(uint32_t numVertices, uint32_t numMorphs, float coverage, uint32_t seed, std::vector<Morph> & morphs)
+	{
+		Random random(seed);
+		uint32_t span = (std::max)(1U, (uint32_t)(numVertices * coverage));
+		for(uint32_t m = 0; m < numMorphs; m++)
+		{
+			Morph morph;
+			morph.name = "Synthetic" + std::to_string(m);
+			morph.deltas.reserve(span);
+
+			uint32_t first = random.Next(numVertices);
+			for(uint32_t k = 0; k < span; k++)
+			{
+				Morpher::TriVertexDelta delta;
+				delta.index = (uint16_t)((first + k) % numVertices);
+				delta.x = random.Next(-0.05f, 0.05f);
+				delta.y = random.Next(-0.05f, 0.05f);
+				delta.z = random.Next(-0.05f, 0.05f);
+				morph.deltas.push_back(delta);
+			}
+			morphs.push_back(std::move(morph));
+		}
+	}
+
+	template<typename T>
+	void Append(std::vector<uint8_t> & out, const T & value)
+	{
+		const uint8_t * bytes = (const uint8_t *)&value;
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	inline void AppendName(std::vector<uint8_t> & out, const std::string & name)
+	{
+		uint8_t length = (uint8_t)(std::min)(name.size(), (size_t)255);
+		out.push_back(length);
+		out.insert(out.end(), name.begin(), name.begin() + length);
+	}
+
+	// Writes the shapes as a 'TRI\0' or 'TRIP' file, packed deltas are quantized against the largest component of each morph
+	inline void BuildTriFile(const std::vector<Shape> & shapes, bool packed, std::vector<uint8_t> & out)
+	{
+		out.clear();
+		Append(out, (uint32_t)(packed ? Morpher::TriReader::kFormatPacked : Morpher::TriReader::kFormatFull));
+		if(packed)
+			Append(out, (uint16_t)shapes.size());
+		else
+			Append(out, (uint32_t)shapes.size());
+
+		for(auto & shape : shapes)
+		{
+			AppendName(out, shape.name);
+
+			size_t shapeSizeOffset = out.size();
+			if(!packed)
+				Append(out, (uint32_t)0);
+
+			if(packed)
+				Append(out, (uint16_t)shape.morphs.size());
+			else
+				Append(out, (uint32_t)shape.morphs.size());
+
+			for(auto & morph : shape.morphs)
+			{
+				AppendName(out, morph.name);
+
+				if(!packed) {
+					Append(out, (uint32_t)(morph.deltas.size() * Morpher::TriReader::GetDeltaSize(false) + sizeof(uint32_t)));
+					Append(out, (uint32_t)morph.deltas.size());
+					for(auto & delta : morph.deltas)
+					{
+						Append(out, (uint32_t)delta.index);
+						Append(out, delta.x);
+						Append(out, delta.y);
+						Append(out, delta.z);
+					}
+					continue;
+				}
+
+				float largest = 0.0f;
+				for(auto & delta : morph.deltas)
+					largest = (std::max)(largest, (std::max)(fabsf(delta.x), (std::max)(fabsf(delta.y), fabsf(delta.z))));
+
+				float multiplier = largest > 0.0f ? largest / 32767.0f : 1.0f;
+				Append(out, multiplier);
+				Append(out, (uint16_t)morph.deltas.size());
+				for(auto & delta : morph.deltas)
+				{
+					Append(out, delta.index);
+					Append(out, (int16_t)lrintf(delta.x / multiplier));
+					Append(out, (int16_t)lrintf(delta.y / multiplier));
+					Append(out, (int16_t)lrintf(delta.z / multiplier));
+				}
+			}
+
+			if(!packed) {
+				uint32_t shapeSize = (uint32_t)(out.size() - shapeSizeOffset);
+				memcpy(&out[shapeSizeOffset], &shapeSize, sizeof(uint32_t));
+			}
+		}
+	}
+
+	// Template lines shaped like the ones body mods ship, a few sets of ranged morphs with alternatives
+	inline void BuildBodyGenTemplates(uint32_t numTemplates, uint32_t seed, std::vector<std::string> & lines)
+	{
+		Random random(seed);
+		for(uint32_t t = 0; t < numTemplates; t++)
+		{
+			std::string line = "Template" + std::to_string(t) + " = ";
+			uint32_t sets = 1 + random.Next(3);
+			for(uint32_t s = 0; s < sets; s++)
+			{
+				if(s)
+					line += " / ";
+
+				uint32_t morphs = 4 + random.Next(12);
+				for(uint32_t m = 0; m < morphs; m++)
+				{
+					if(m)
+						line += ", ";
+
+					uint32_t alternatives = 1 + random.Next(2);
+					for(uint32_t a = 0; a < alternatives; a++)
+					{
+						if(a)
+							line += " | ";
+
+						line += "Morph" + std::to_string(random.Next(200)) + "@";
+						line += std::to_string(random.Next(0.0f, 0.5f)).substr(0, 4);
+						if(random.Next(2))
+							line += ":" + std::to_string(random.Next(0.5f, 1.0f)).substr(0, 4);
+					}
+				}
+			}
+			lines.push_back(line);
+		}
+	}
+
+	// Morph lines assigning templates to NPCs, the right-hand side is what gets parsed
+	inline void BuildBodyGenMorphs(uint32_t numLines, uint32_t numTemplates, uint32_t seed, std::vector<std::string> & lines)
+	{
+		Random random(seed);
+		for(uint32_t l = 0; l < numLines; l++)
+		{
+			char formId[16];
+			snprintf(formId, sizeof(formId), "%06X", 0x1000 + l);
+
+			std::string line = std::string("Fallout4.esm|") + formId + "|Female = ";
+			uint32_t slots = 1 + random.Next(3);
+			for(uint32_t s = 0; s < slots; s++)
+			{
+				if(s)
+					line += ", ";
+
+				uint32_t alternatives = 1 + random.Next(4);
+				for(uint32_t a = 0; a < alternatives; a++)
+				{
+					if(a)
+						line += " | ";
+					line += "Template" + std::to_string(random.Next(numTemplates));
+				}
+			}
+			lines.push_back(line);
+		}
+	}
+}
@@ -0,0 +1,616 @@
+// Benchmarks for the morph and loading hot paths on reproducible synthetic inputs
+// f4ee_bench [--filter <text>] [--min-time <ms>] [--threshold <n>] [--json <file>] [--compare <baseline.json>] [--tolerance <percent>]
+// With --compare the medians are checked against a saved --json run, the exit code is 2 when anything got slower than the tolerance
+
+#include "Morpher.h"
+#include "MeshDump.h"
+#include "MorphMatrix.h"
+#include "MorphIds.h"
+#include "GeometryCache.h"
+#include "TriReader.h"
+#include "TriArena.h"
+#include "StringHash.h"
+#include "BodyGenParser.h"
+#include "ShardedCache.h"
+#include "kd_matcher.hpp"
+#include "SyntheticData.h"
+
+#ifdef F4EE_BENCH_PLUGIN
+#include "StringTable.h"
+
+StringTable g_stringTable;
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Options
+	{
+		Options() : minTime(250.0), threshold(0), tolerance(10.0) { }
+
+		std::string	filter;
+		std::string	jsonPath;
+		std::string	comparePath;
+		double		minTime;
+		uint32_t	threshold;
+		double		tolerance;
+	};
+
+	struct Result
+	{
+		std::string	name;
+		std::string	unit;
+		uint64_t	samples;
+		double		items;
+		double		meanNs;
+		double		medianNs;
+		double		minNs;
+	};
+
+	// Keeps the optimizer from dropping work whose result is otherwise unused
+	volatile uint64_t g_sink = 0;
+
+	class Runner
+	{
+	public:
+		Runner(const Options & options) : m_options(options) { }
+
+		// Times whole calls of func until the minimum time has passed, items is the work one call does
+		template<typename F>
+		void Run(const char * name, const char * unit, double items, F && func)
+		{
+			if(!m_options.filter.empty() && std::string(name).find(m_options.filter) == std::string::npos)
+				return;
+
+			func();
+
+			std::vector<double> samples;
+			double elapsed = 0.0;
+			while(elapsed < m_options.minTime * 1e6 || samples.size() < 5)
+			{
+				Clock::time_point start = Clock::now();
+				func();
+				double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+				samples.push_back(ns);
+				elapsed += ns;
+			}
+
+			std::sort(samples.begin(), samples.end());
+			double total = 0.0;
+			for(double sample : samples)
+				total += sample;
+
+			Result result;
+			result.name = name;
+			result.unit = unit;
+			result.samples = samples.size();
+			result.items = items;
+			result.meanNs = total / samples.size();
+			result.medianNs = samples[samples.size() / 2];
+			result.minNs = samples.front();
+			m_results.push_back(result);
+
+			printf("%-28s %12.1f us median %12.1f us min %10.2f M %s/s  (%llu samples)\n", name, result.medianNs / 1000.0, result.minNs / 1000.0, items / result.medianNs * 1000.0, unit, (unsigned long long)result.samples);
+		}
+
+		const std::vector<Result> & GetResults() const { return m_results; }
+
+	protected:
+		const Options &		m_options;
+		std::vector<Result>	m_results;
+	};
+
+	bool ParseOptions(int argc, char ** argv, Options & options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if(arg == "--filter" && hasValue)
+				options.filter = argv[++i];
+			else if(arg == "--min-time" && hasValue)
+				options.minTime = atof(argv[++i]);
+			else if(arg == "--threshold" && hasValue)
+				options.threshold = strtoul(argv[++i], nullptr, 10);
+			else if(arg == "--json" && hasValue)
+				options.jsonPath = argv[++i];
+			else if(arg == "--compare" && hasValue)
+				options.comparePath = argv[++i];
+			else if(arg == "--tolerance" && hasValue)
+				options.tolerance = atof(argv[++i]);
+			else
+				return false;
+		}
+
+		return true;
+	}
+
+	bool WriteJson(const std::string & path, const std::vector<Result> & results)
+	{
+		std::ofstream file(path);
+		if(!file)
+			return false;
+
+		file << "{\n\t\"benchmarks\": [\n";
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			const Result & result = results[i];
+			char line[512];
+			snprintf(line, sizeof(line), "\t\t{ \"name\": \"%s\", \"unit\": \"%s\", \"samples\": %llu, \"items\": %.0f, \"mean_ns\": %.1f, \"median_ns\": %.1f, \"min_ns\": %.1f }%s\n",
+				result.name.c_str(), result.unit.c_str(), (unsigned long long)result.samples, result.items, result.meanNs, result.medianNs, result.minNs, i + 1 < results.size() ? "," : "");
+			file << line;
+		}
+		file << "\t]\n}\n";
+		return (bool)file;
+	}
+
+	// Only reads files written by WriteJson, one benchmark per line
+	bool ReadBaseline(const std::string & path, std::map<std::string, double> & medians)
+	{
+		std::ifstream file(path);
+		if(!file)
+			return false;
+
+		std::string line;
+		while(std::getline(file, line))
+		{
+			size_t name = line.find("\"name\": \"");
+			size_t median = line.find("\"median_ns\": ");
+			if(name == std::string::npos || median == std::string::npos)
+				continue;
+
+			name += 9;
+			size_t nameEnd = line.find('"', name);
+			if(nameEnd == std::string::npos)
+				continue;
+
+			medians[line.substr(name, nameEnd - name)] = atof(line.c_str() + median + 13);
+		}
+
+		return !medians.empty();
+	}
+
+	// Returns the number of benchmarks slower than the tolerance
+	uint32_t Compare(const std::vector<Result> & results, const std::map<std::string, double> & baseline, double tolerance)
+	{
+		uint32_t regressions = 0;
+		printf("\n%-28s %14s %14s %9s\n", "benchmark", "baseline us", "current us", "change");
+		for(auto & result : results)
+		{
+			auto it = baseline.find(result.name);
+			if(it == baseline.end() || it->second <= 0.0) {
+				printf("%-28s %14s %14.1f %9s\n", result.name.c_str(), "-", result.medianNs / 1000.0, "new");
+				continue;
+			}
+
+			double change = (result.medianNs / it->second - 1.0) * 100.0;
+			const char * verdict = "";
+			if(change > tolerance) {
+				verdict = "  slower";
+				regressions++;
+			}
+			else if(change < -tolerance)
+				verdict = "  faster";
+
+			printf("%-28s %14.1f %14.1f %+8.1f%%%s\n", result.name.c_str(), it->second / 1000.0, result.medianNs / 1000.0, change, verdict);
+		}
+
+		return regressions;
+	}
+
+	// Parses a whole file the way the loader stores it
+	uint64_t ParseTri(const std::vector<uint8_t> & bytes)
+	{
+		Morpher::TriArena arena;
+		if(!arena.Parse(bytes.data(), bytes.size()))
+			return 0;
+
+		return arena.GetMorphCount();
+	}
+
+	// One morph at a time the way shapes were morphed before MorphMatrix, kept as the baseline it is measured against
+	void ApplyMorph(const Morpher::TriVertexDelta * deltas, uint32_t numDeltas, float factor, Morpher::Vector3 * vertices, uint32_t numVertices, uint8_t * touched)
+	{
+		for(uint32_t i = 0; i < numDeltas; i++)
+		{
+			if(deltas[i].index >= numVertices)
+				continue;
+
+			Morpher::Vector3 & vertex = vertices[deltas[i].index];
+			vertex.x += deltas[i].x * factor;
+			vertex.y += deltas[i].y * factor;
+			vertex.z += deltas[i].z * factor;
+			touched[deltas[i].index] = 1;
+		}
+	}
+
+	void ApplyMorph(const Morpher::TriPackedVertexDelta * deltas, uint32_t numDeltas, float multiplier, float factor, Morpher::Vector3 * vertices, uint32_t numVertices, uint8_t * touched)
+	{
+		for(uint32_t i = 0; i < numDeltas; i++)
+		{
+			if(deltas[i].index >= numVertices)
+				continue;
+
+			Morpher::Vector3 & vertex = vertices[deltas[i].index];
+			vertex.x += ((float)deltas[i].x * multiplier) * factor;
+			vertex.y += ((float)deltas[i].y * multiplier) * factor;
+			vertex.z += ((float)deltas[i].z * multiplier) * factor;
+			touched[deltas[i].index] = 1;
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options)) {
+		printf("usage: f4ee_bench [--filter <text>] [--min-time <ms>] [--threshold <n>] [--json <file>] [--compare <baseline.json>] [--tolerance <percent>]\n");
+		return 1;
+	}
+
+	// Single threaded by default, so numbers do not depend on what else the machine is doing
+	Morpher::SetParallelVertexThreshold(options.threshold);
+
+	Runner runner(options);
+
+	// A body sized mesh and three shapes worth of sliders on it
+	Morpher::MeshDump mesh;
+	Synthetic::BuildCylinder(160, 240, false, mesh);
+	Morpher::GeometryView view = mesh.GetView();
+
+	std::vector<Synthetic::Shape> shapes(3);
+	for(uint32_t s = 0; s < shapes.size(); s++)
+	{
+		shapes[s].name = "Shape" + std::to_string(s);
+		Synthetic::BuildMorphs(mesh.numVertices, 60, 0.04f, 100 + s, shapes[s].morphs);
+	}
+
+	std::vector<uint8_t> fullTri, packedTri;
+	Synthetic::BuildTriFile(shapes, false, fullTri);
+	Synthetic::BuildTriFile(shapes, true, packedTri);
+
+	runner.Run("tri_parse_full", "bytes", (double)fullTri.size(), [&]()
+	{
+		g_sink += ParseTri(fullTri);
+	});
+
+	runner.Run("tri_parse_packed", "bytes", (double)packedTri.size(), [&]()
+	{
+		g_sink += ParseTri(packedTri);
+	});
+
+	// What a current '.f4eemorph' costs instead of parsing, the image is used in place
+	Morpher::TriArena::SourceKey cacheKey;
+	std::vector<uint8_t> cacheImage;
+	{
+		Morpher::TriArena arena;
+		arena.Parse(fullTri.data(), fullTri.size());
+		cacheKey.size = fullTri.size();
+		arena.Save(cacheKey, cacheImage);
+	}
+
+	runner.Run("tri_cache_load", "bytes", (double)fullTri.size(), [&]()
+	{
+		Morpher::TriArena arena;
+		if(arena.Load(cacheImage.data(), cacheImage.size(), cacheKey, nullptr))
+			g_sink += arena.GetMorphCount();
+	});
+
+	runner.Run("tri_source_hash", "bytes", (double)fullTri.size(), [&]()
+	{
+		g_sink += Morpher::TriArena::HashSource(fullTri.data(), fullTri.size());
+	});
+
+	// Deltas of the first shape in both storage formats
+	std::vector<std::vector<Morpher::TriPackedVertexDelta>> packedMorphs;
+	std::vector<float> multipliers;
+	{
+		Morpher::TriReader reader(packedTri.data(), packedTri.size());
+		std::string name;
+		uint32_t morphCount = 0, vertexCount = 0;
+		float multiplier = 0.0f;
+		reader.ReadHeader();
+		reader.ReadShape(name, morphCount);
+		for(uint32_t m = 0; m < morphCount && reader.ReadMorph(name, multiplier, vertexCount); m++)
+		{
+			packedMorphs.emplace_back(vertexCount);
+			reader.ReadDeltas(packedMorphs.back().data(), vertexCount);
+			multipliers.push_back(multiplier);
+		}
+	}
+
+	size_t totalDeltas = 0;
+	for(auto & morph : shapes[0].morphs)
+		totalDeltas += morph.deltas.size();
+
+	std::vector<Morpher::Vector3> basePositions(mesh.numVertices);
+	Morpher::DecodeVertices(mesh.layout, mesh.vertexBlock.data(), mesh.numVertices, basePositions.data(), nullptr);
+	std::vector<Morpher::Vector3> positions(basePositions);
+	std::vector<uint8_t> touched(mesh.numVertices);
+
+	runner.Run("apply_morph_full", "deltas", (double)totalDeltas, [&]()
+	{
+		for(auto & morph : shapes[0].morphs)
+			ApplyMorph(morph.deltas.data(), (uint32_t)morph.deltas.size(), 0.5f, positions.data(), mesh.numVertices, touched.data());
+	});
+
+	runner.Run("apply_morph_packed", "deltas", (double)totalDeltas, [&]()
+	{
+		for(size_t m = 0; m < packedMorphs.size(); m++)
+			ApplyMorph(packedMorphs[m].data(), (uint32_t)packedMorphs[m].size(), multipliers[m], 0.5f, positions.data(), mesh.numVertices, touched.data());
+	});
+
+	// Every morph of the shape at once, as ApplyMorphsToShape does it
+	Morpher::TriArena fullArena;
+	fullArena.Parse(fullTri.data(), fullTri.size());
+	const Morpher::TriArena::Shape * firstShape = fullArena.FindShape(shapes[0].name.c_str(), shapes[0].name.size(), HashLower(shapes[0].name.c_str(), shapes[0].name.size()));
+	Morpher::MorphMatrix matrix, sparseMatrix;
+	matrix.Build(fullArena, *firstShape);
+	std::vector<float> weights(matrix.GetColumnCount(), 0.5f);
+
+	// The same morphs kept as index and delta lists whatever their density
+	float denseMorphDensity = Morpher::GetDenseMorphDensity();
+	Morpher::SetDenseMorphDensity(2.0f);
+	sparseMatrix.Build(fullArena, *firstShape);
+	Morpher::SetDenseMorphDensity(denseMorphDensity);
+
+	// An actor's morphs resolved to the shape's slots, by name the way it used to be and by id through the shape's table
+	std::vector<std::string> actorMorphNames;
+	std::vector<uint64_t> actorMorphHashes;
+	std::vector<uint32_t> actorMorphIds;
+	for(uint32_t m = 0; m < firstShape->numMorphs; m += 2)
+		actorMorphNames.push_back(fullArena.GetName(fullArena.GetMorphs()[firstShape->firstMorph + m].name));
+	for(uint32_t i = 0; i < 20; i++)
+		actorMorphNames.push_back("NotInThisShape" + std::to_string(i));
+	for(auto & name : actorMorphNames)
+	{
+		actorMorphHashes.push_back(HashLower(name.c_str(), name.size()));
+		actorMorphIds.push_back(Morpher::GetMorphId(name.c_str(), name.size()));
+	}
+
+	std::vector<int32_t> slots;
+	for(uint32_t m = 0; m < firstShape->numMorphs; m++)
+	{
+		const char * name = fullArena.GetName(fullArena.GetMorphs()[firstShape->firstMorph + m].name);
+		uint32_t morphId = Morpher::GetMorphId(name, strlen(name));
+		if(morphId >= slots.size())
+			slots.resize(morphId + 1, -1);
+		slots[morphId] = (int32_t)m;
+	}
+
+	runner.Run("resolve_morphs_by_name", "morphs", (double)actorMorphNames.size(), [&]()
+	{
+		for(size_t i = 0; i < actorMorphNames.size(); i++)
+		{
+			auto morph = fullArena.FindMorph(*firstShape, actorMorphNames[i].c_str(), actorMorphNames[i].size(), actorMorphHashes[i]);
+			if(morph)
+				g_sink += morph - fullArena.GetMorphs();
+		}
+	});
+
+	runner.Run("resolve_morphs_by_id", "morphs", (double)actorMorphIds.size(), [&]()
+	{
+		for(uint32_t morphId : actorMorphIds)
+		{
+			int32_t slot = morphId < slots.size() ? slots[morphId] : -1;
+			if(slot >= 0)
+				g_sink += slot;
+		}
+	});
+
+	runner.Run("apply_morph_matrix", "deltas", (double)totalDeltas, [&]()
+	{
+		g_sink += matrix.Apply(weights.data(), positions.data(), mesh.numVertices, touched.data());
+	});
+
+	runner.Run("apply_morph_sparse", "deltas", (double)totalDeltas, [&]()
+	{
+		g_sink += sparseMatrix.Apply(weights.data(), positions.data(), mesh.numVertices, touched.data());
+	});
+
+	// Full precision morphs stored in 16 bits, the arena and the matrix both halve
+	runner.Run("tri_quantize", "deltas", (double)fullArena.GetDeltaCount(), [&]()
+	{
+		Morpher::TriArena arena;
+		float error;
+		arena.Parse(fullTri.data(), fullTri.size());
+		g_sink += arena.Quantize(1.0f, error);
+	});
+
+	Morpher::TriArena quantizedArena;
+	float quantizationError;
+	quantizedArena.Parse(fullTri.data(), fullTri.size());
+	quantizedArena.Quantize(1.0f, quantizationError);
+	Morpher::MorphMatrix quantizedMatrix;
+	quantizedMatrix.Build(quantizedArena, *quantizedArena.FindShape(shapes[0].name.c_str(), shapes[0].name.size(), HashLower(shapes[0].name.c_str(), shapes[0].name.size())));
+
+	runner.Run("apply_morph_quantized", "deltas", (double)totalDeltas, [&]()
+	{
+		g_sink += quantizedMatrix.Apply(weights.data(), positions.data(), mesh.numVertices, touched.data());
+	});
+
+	// Frame recalculation over the whole mesh, the region is built once by the first Apply
+	std::vector<uint8_t> target(mesh.vertexBlock.size());
+	Morpher::MeshTopologyPtr topology;
+	{
+		MorphApplicator morpher(view, target.data(), topology);
+		std::fill(morpher.GetTouched().begin(), morpher.GetTouched().end(), 1);
+		morpher.Apply();
+
+		runner.Run("recalc_normals", "vertices", mesh.numVertices, [&]()
+		{
+			morpher.RecalcNormals(view.numTriangles, view.triangles);
+		});
+
+		runner.Run("calc_tangent_space", "vertices", mesh.numVertices, [&]()
+		{
+			morpher.CalcTangentSpace(view.numTriangles, view.triangles);
+		});
+	}
+
+	// What a single shape costs per actor: decode, the shape's sliders, region frame and encode
+	std::vector<float> shapeWeights(matrix.GetColumnCount(), 0.0f);
+	std::fill(shapeWeights.begin(), shapeWeights.begin() + (std::min)(shapeWeights.size(), (size_t)16), 0.5f);
+	runner.Run("morph_shape", "vertices", mesh.numVertices, [&]()
+	{
+		MorphApplicator morpher(view, target.data(), topology, [&](std::vector<Morpher::Vector3> & vertices, std::vector<uint8_t> & moved)
+		{
+			matrix.Apply(shapeWeights.data(), vertices.data(), mesh.numVertices, moved.data());
+		});
+	});
+
+	// The same shape for an actor whose morphs another one already has: hash the base, look the block up and copy it
+	Morpher::GeometryCache geometryCache(0x10000000LL);
+	{
+		Morpher::GeometryKey key("Meshes\\Actors\\Character\\FemaleBody.tri", shapes[0].name.c_str(), 0, mesh.numVertices, Morpher::TriArena::HashSource(mesh.vertexBlock.data(), mesh.vertexBlock.size()), weights.data(), (uint32_t)weights.size());
+		geometryCache.Complete(key, std::make_shared<const std::vector<uint8_t>>(target), target.size() + key.GetMemoryUsage());
+	}
+
+	runner.Run("morph_shape_shared", "vertices", mesh.numVertices, [&]()
+	{
+		Morpher::GeometryKey key("Meshes\\Actors\\Character\\FemaleBody.tri", shapes[0].name.c_str(), 0, mesh.numVertices, Morpher::TriArena::HashSource(mesh.vertexBlock.data(), mesh.vertexBlock.size()), weights.data(), (uint32_t)weights.size());
+		Morpher::GeometryBlockPtr block;
+		std::shared_future<Morpher::GeometryBlockPtr> pending;
+		if(geometryCache.Acquire(key, block, pending) == Morpher::GeometryCache::kFound)
+			memcpy(target.data(), block->data(), block->size());
+		g_sink += target[0];
+	});
+
+	// Seam matching on the positions the normals are built from
+	std::vector<Morpher::Vector3> normalSpace(mesh.numVertices);
+	for(uint32_t i = 0; i < mesh.numVertices; i++)
+	{
+		normalSpace[i].x = basePositions[i].x * -0.1f;
+		normalSpace[i].z = basePositions[i].y * 0.1f;
+		normalSpace[i].y = basePositions[i].z * 0.1f;
+	}
+
+	runner.Run("kd_matcher", "vertices", mesh.numVertices, [&]()
+	{
+		kd_matcher matcher(normalSpace.data(), (int)normalSpace.size());
+		g_sink += matcher.matches.size();
+	});
+
+	runner.Run("weld_groups", "vertices", mesh.numVertices, [&]()
+	{
+		Morpher::WeldGroups groups;
+		groups.Build(normalSpace.data(), (uint32_t)normalSpace.size());
+		g_sink += groups.GetGroupCount();
+	});
+
+	// Names the way they show up as keys, morph names and mesh paths
+	std::vector<std::string> names;
+	for(auto & shape : shapes)
+	{
+		for(auto & morph : shape.morphs)
+			names.push_back(morph.name);
+	}
+	for(uint32_t i = 0; i < 2000; i++)
+		names.push_back("Meshes\\Actors\\Character\\CharacterAssets\\Outfit" + std::to_string(i) + "\\FemaleBody.tri");
+
+	runner.Run("string_hash", "strings", (double)names.size(), [&]()
+	{
+		for(auto & name : names)
+			g_sink += HashLower(name.c_str(), name.size());
+	});
+
+	std::vector<std::string> templateLines, morphLines;
+	Synthetic::BuildBodyGenTemplates(500, 7, templateLines);
+	Synthetic::BuildBodyGenMorphs(2000, 500, 8, morphLines);
+
+	runner.Run("bodygen_templates", "lines", (double)templateLines.size(), [&]()
+	{
+		std::string lSide, rSide, error;
+		BodyGen::TemplateSets sets;
+		for(auto & line : templateLines)
+		{
+			if(BodyGen::SplitLine(line, lSide, rSide) && BodyGen::ParseTemplate(rSide, sets, error))
+				g_sink += sets.size();
+		}
+	});
+
+	runner.Run("bodygen_morphs", "lines", (double)morphLines.size(), [&]()
+	{
+		std::string lSide, rSide;
+		std::vector<std::vector<std::string>> slots;
+		for(auto & line : morphLines)
+		{
+			if(BodyGen::SplitLine(line, lSide, rSide)) {
+				BodyGen::ParseTemplateSlots(rSide, slots);
+				g_sink += slots.size();
+			}
+		}
+	});
+
+	// Every lookup of a cached TRI goes through here, the churn run keeps half the files evicting each other
+	typedef Morpher::ShardedCache<std::string, std::shared_ptr<uint32_t>> MorphCache;
+	MorphCache hitCache(UINT64_MAX);
+	for(auto & name : names)
+		hitCache.Complete(name, std::make_shared<uint32_t>(0), 1024);
+
+	runner.Run("morph_cache_hit", "lookups", (double)names.size(), [&]()
+	{
+		std::shared_ptr<uint32_t> value;
+		std::shared_future<std::shared_ptr<uint32_t>> pending;
+		for(auto & name : names)
+			g_sink += hitCache.Acquire(name, value, pending);
+	});
+
+	MorphCache churnCache((uint64_t)names.size() / 2 * 1024);
+	runner.Run("morph_cache_churn", "lookups", (double)names.size(), [&]()
+	{
+		for(auto & name : names)
+		{
+			g_sink += (uint64_t)churnCache.GetOrLoad(name, [](uint64_t & size) { size = 1024; return std::make_shared<uint32_t>(0); }).get();
+			churnCache.Shrink();
+		}
+	});
+
+#ifdef F4EE_BENCH_PLUGIN
+	// Interning the names, then looking up the id of each like serialization does
+	std::vector<StringTableItem> items;
+	for(auto & name : names)
+		items.push_back(g_stringTable.GetString(F4EEFixedString(name)));
+
+	runner.Run("string_table_get_string", "strings", (double)names.size(), [&]()
+	{
+		for(auto & name : names)
+			g_sink += (uint64_t)g_stringTable.GetString(F4EEFixedString(name)).get();
+	});
+
+	runner.Run("string_table_get_string_id", "strings", (double)items.size(), [&]()
+	{
+		for(auto & item : items)
+			g_sink += g_stringTable.GetStringID(item);
+	});
+#endif
+
+	if(!options.jsonPath.empty() && !WriteJson(options.jsonPath, runner.GetResults())) {
+		fprintf(stderr, "failed to write %s\n", options.jsonPath.c_str());
+		return 1;
+	}
+
+	if(!options.comparePath.empty()) {
+		std::map<std::string, double> baseline;
+		if(!ReadBaseline(options.comparePath, baseline)) {
+			fprintf(stderr, "failed to read baseline %s\n", options.comparePath.c_str());
+			return 1;
+		}
+
+		if(Compare(runner.GetResults(), baseline, options.tolerance) > 0)
+			return 2;
+	}
+
+	return 0;
+}
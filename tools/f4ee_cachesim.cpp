@@ -0,0 +1,97 @@
+// Replays a recorded morph cache trace against every policy and a set of cache limits
+// f4ee_cachesim --trace <file> [--limit <MB>]... [--policy lru|lfu|gds]... [--low-water <fraction>]
+// Record a trace in game with bRecordMorphCacheTrace=1 under [BodyMorph], it is written to Data\F4SE\Plugins\F4EE\MorphCache.trace
+
+#include "CacheTrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		Options() : lowWater(1.0f) { }
+
+		std::string							tracePath;
+		std::vector<uint64_t>				limits;
+		std::vector<Morpher::CachePolicy>	policies;
+		float								lowWater;	// fCacheLowWater under [BodyMorph]
+	};
+
+	void Usage()
+	{
+		printf("usage: f4ee_cachesim --trace <file> [--limit <MB>]... [--policy lru|lfu|gds]... [--low-water <fraction>]\n");
+	}
+
+	bool ParseOptions(int argc, char ** argv, Options & options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if(arg == "--trace" && hasValue)
+				options.tracePath = argv[++i];
+			else if(arg == "--limit" && hasValue)
+				options.limits.push_back(strtoull(argv[++i], nullptr, 10) * 1024 * 1024);
+			else if(arg == "--low-water" && hasValue)
+				options.lowWater = strtof(argv[++i], nullptr);
+			else if(arg == "--policy" && hasValue) {
+				Morpher::CachePolicy policy;
+				if(!Morpher::ParseCachePolicy(argv[++i], policy))
+					return false;
+				options.policies.push_back(policy);
+			}
+			else
+				return false;
+		}
+
+		if(options.limits.empty()) {
+			for(uint64_t limit = 128; limit <= 2048; limit *= 2)
+				options.limits.push_back(limit * 1024 * 1024);
+		}
+
+		if(options.policies.empty()) {
+			for(uint32_t i = 0; i < Morpher::kCachePolicyCount; i++)
+				options.policies.push_back((Morpher::CachePolicy)i);
+		}
+
+		return !options.tracePath.empty() && options.lowWater > 0.0f && options.lowWater <= 1.0f;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options)) {
+		Usage();
+		return 1;
+	}
+
+	std::vector<Morpher::CacheTraceEvent> events;
+	if(!Morpher::ReadCacheTrace(options.tracePath.c_str(), events)) {
+		fprintf(stderr, "failed to read %s\n", options.tracePath.c_str());
+		return 1;
+	}
+
+	// Everything a cache without a limit would load, the floor for bytes loaded
+	Morpher::CacheReplayResult unbounded;
+	Morpher::ReplayCacheTrace(events, Morpher::kCachePolicyLRU, UINT64_MAX, unbounded);
+	printf("trace: %zu events, %llu accesses, %llu files, %.1f MB working set\n", events.size(), (unsigned long long)unbounded.accesses, (unsigned long long)unbounded.misses, unbounded.bytesLoaded / 1048576.0);
+
+	printf("%10s %-6s %9s %10s %10s %14s %12s\n", "limit MB", "policy", "hit rate", "misses", "evictions", "loaded MB", "peak MB");
+	for(uint64_t limit : options.limits)
+	{
+		for(Morpher::CachePolicy policy : options.policies)
+		{
+			Morpher::CacheReplayResult result;
+			Morpher::ReplayCacheTrace(events, policy, limit, result, options.lowWater);
+			printf("%10llu %-6s %8.2f%% %10llu %10llu %14.1f %12.1f\n", (unsigned long long)(limit / 1048576), Morpher::GetCachePolicyName(policy), result.accesses ? 100.0 * result.hits / result.accesses : 0.0,
+				(unsigned long long)result.misses, (unsigned long long)result.evictions, result.bytesLoaded / 1048576.0, result.peakSize / 1048576.0);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+// Standalone driver for the morph engine, morphs a synthetic or dumped mesh and reports the throughput
+// f4ee_morph [--mesh <file.mesh>] [--grid <columns> <rows>] [--full] [--tri <file.tri> --shape <name>] [--value <v>]
+//            [--morphs <n>] [--coverage <0-1>] [--iterations <n>] [--threshold <n>] [--out <file.mesh>]
+
+#include "Morpher.h"
+#include "MeshDump.h"
+#include "MorphMatrix.h"
+#include "TriArena.h"
+#include "StringHash.h"
+#include "SyntheticData.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Options
+	{
+		Options() : columns(160), rows(240), fullPrecision(false), value(1.0f), morphs(16), coverage(0.05f), iterations(100), threshold(Morpher::GetParallelVertexThreshold()) { }
+
+		std::string	meshPath;
+		std::string	triPath;
+		std::string	shapeName;
+		std::string	outPath;
+		uint32_t	columns;
+		uint32_t	rows;
+		bool		fullPrecision;
+		float		value;
+		uint32_t	morphs;
+		float		coverage;
+		uint32_t	iterations;
+		uint32_t	threshold;
+	};
+
+	double Milliseconds(Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	bool ReadFile(const std::string & path, std::vector<uint8_t> & bytes)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if(!file)
+			return false;
+
+		file.seekg(0, std::ios::end);
+		bytes.resize((size_t)file.tellg());
+		file.seekg(0, std::ios::beg);
+		return (bool)file.read((char *)bytes.data(), bytes.size());
+	}
+
+	bool WriteFile(const std::string & path, const std::vector<uint8_t> & bytes)
+	{
+		std::ofstream file(path, std::ios::binary);
+		return file && file.write((const char *)bytes.data(), bytes.size());
+	}
+
+	void Usage()
+	{
+		printf("usage: f4ee_morph [--mesh <file.mesh>] [--grid <columns> <rows>] [--full] [--tri <file.tri> --shape <name>] [--value <v>]\n");
+		printf("                  [--morphs <n>] [--coverage <0-1>] [--iterations <n>] [--threshold <n>] [--out <file.mesh>]\n");
+	}
+
+	bool ParseOptions(int argc, char ** argv, Options & options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if(arg == "--mesh" && hasValue)
+				options.meshPath = argv[++i];
+			else if(arg == "--grid" && i + 2 < argc) {
+				options.columns = strtoul(argv[++i], nullptr, 10);
+				options.rows = strtoul(argv[++i], nullptr, 10);
+			}
+			else if(arg == "--full")
+				options.fullPrecision = true;
+			else if(arg == "--tri" && hasValue)
+				options.triPath = argv[++i];
+			else if(arg == "--shape" && hasValue)
+				options.shapeName = argv[++i];
+			else if(arg == "--value" && hasValue)
+				options.value = (float)atof(argv[++i]);
+			else if(arg == "--morphs" && hasValue)
+				options.morphs = strtoul(argv[++i], nullptr, 10);
+			else if(arg == "--coverage" && hasValue)
+				options.coverage = (float)atof(argv[++i]);
+			else if(arg == "--iterations" && hasValue)
+				options.iterations = strtoul(argv[++i], nullptr, 10);
+			else if(arg == "--threshold" && hasValue)
+				options.threshold = strtoul(argv[++i], nullptr, 10);
+			else if(arg == "--out" && hasValue)
+				options.outPath = argv[++i];
+			else
+				return false;
+		}
+
+		return options.iterations > 0;
+	}
+
+	// Parses the file the way the plugin does, without a name the first shape of the arena is used
+	bool LoadTriArena(const Options & options, Morpher::TriArena & arena, const Morpher::TriArena::Shape *& shape)
+	{
+		std::vector<uint8_t> bytes;
+		if(!ReadFile(options.triPath, bytes)) {
+			fprintf(stderr, "failed to read %s\n", options.triPath.c_str());
+			return false;
+		}
+
+		Clock::time_point start = Clock::now();
+		if(!arena.Parse(bytes.data(), bytes.size())) {
+			fprintf(stderr, "%s: %s at %zu\n", options.triPath.c_str(), arena.GetError(), arena.GetErrorOffset());
+			return false;
+		}
+
+		double parseTime = Milliseconds(Clock::now() - start);
+		printf("tri: %s, %u shapes, %u morphs, %zu bytes parsed in %.3f ms (%.1f MB/s)\n", arena.IsPacked() ? "TRIP" : "TRI", arena.GetShapeCount(), arena.GetMorphCount(), bytes.size(), parseTime, bytes.size() / 1000.0 / (std::max)(parseTime, 1e-6));
+
+		if(options.shapeName.empty())
+			shape = arena.GetShapeCount() ? &arena.GetShapes()[0] : nullptr;
+		else
+			shape = arena.FindShape(options.shapeName.c_str(), options.shapeName.size(), HashLower(options.shapeName.c_str(), options.shapeName.size()));
+
+		if(!shape) {
+			fprintf(stderr, "shape %s not found\n", options.shapeName.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options)) {
+		Usage();
+		return 1;
+	}
+
+	Morpher::SetParallelVertexThreshold(options.threshold);
+
+	Morpher::MeshDump mesh;
+	if(!options.meshPath.empty()) {
+		std::vector<uint8_t> bytes;
+		if(!ReadFile(options.meshPath, bytes) || !mesh.Deserialize(bytes.data(), bytes.size())) {
+			fprintf(stderr, "failed to load mesh %s\n", options.meshPath.c_str());
+			return 1;
+		}
+	}
+	else if(!Synthetic::BuildCylinder(options.columns, options.rows, options.fullPrecision, mesh)) {
+		fprintf(stderr, "grid %u x %u does not fit 16 bit indices\n", options.columns, options.rows);
+		return 1;
+	}
+
+	// Synthetic morphs go through a TRI file too, so both are morphed by the matrix the plugin builds
+	Morpher::TriArena arena;
+	const Morpher::TriArena::Shape * shape = nullptr;
+	if(!options.triPath.empty()) {
+		if(!LoadTriArena(options, arena, shape))
+			return 1;
+	}
+	else {
+		std::vector<Synthetic::Shape> shapes(1);
+		shapes[0].name = "Synthetic";
+		Synthetic::BuildMorphs(mesh.numVertices, options.morphs, options.coverage, 1234, shapes[0].morphs);
+
+		std::vector<uint8_t> tri;
+		Synthetic::BuildTriFile(shapes, false, tri);
+		arena.Parse(tri.data(), tri.size());
+		shape = &arena.GetShapes()[0];
+	}
+
+	Morpher::MorphMatrix matrix;
+	matrix.Build(arena, *shape);
+	std::vector<float> weights(matrix.GetColumnCount(), options.value);
+
+	size_t totalDeltas = 0;
+	for(uint32_t m = 0; m < shape->numMorphs; m++)
+		totalDeltas += arena.GetMorphs()[shape->firstMorph + m].numDeltas;
+
+	printf("mesh: %u vertices, %zu triangles, stride %u%s\n", mesh.numVertices, mesh.triangles.size(), mesh.layout.stride, mesh.layout.fullPrecision ? ", full precision" : "");
+	printf("morphs: %u, %zu deltas, threshold %u\n", shape->numMorphs, totalDeltas, Morpher::GetParallelVertexThreshold());
+
+	Morpher::GeometryView view = mesh.GetView();
+	std::vector<uint8_t> target(mesh.vertexBlock.size());
+
+	// Reported once rather than on every pass
+	{
+		std::vector<Morpher::Vector3> vertices(mesh.numVertices);
+		int32_t outOfBounds = matrix.Apply(weights.data(), vertices.data(), mesh.numVertices, nullptr);
+		if(outOfBounds >= 0)
+			fprintf(stderr, "warning: morph %s has vertices out of bounds\n", arena.GetName(arena.GetMorphs()[shape->firstMorph + outOfBounds].name));
+	}
+
+	auto accumulate = [&](std::vector<Morpher::Vector3> & vertices, std::vector<uint8_t> & touched)
+	{
+		matrix.Apply(weights.data(), vertices.data(), (uint32_t)vertices.size(), touched.data());
+	};
+
+	// The first pass builds the topology, it is timed on its own like the first actor wearing a shape
+	Morpher::MeshTopologyPtr topology;
+	Clock::time_point start = Clock::now();
+	{
+		MorphApplicator morpher(view, target.data(), topology, accumulate);
+	}
+	double firstTime = Milliseconds(Clock::now() - start);
+
+	std::vector<double> times(options.iterations);
+	for(uint32_t i = 0; i < options.iterations; i++)
+	{
+		start = Clock::now();
+		{
+			MorphApplicator morpher(view, target.data(), topology, accumulate);
+		}
+		times[i] = Milliseconds(Clock::now() - start);
+	}
+
+	std::sort(times.begin(), times.end());
+	double total = 0.0;
+	for(double time : times)
+		total += time;
+
+	double mean = total / times.size();
+	printf("first apply (topology build): %.3f ms\n", firstTime);
+	printf("apply: mean %.3f ms, median %.3f ms, min %.3f ms, max %.3f ms over %u iterations\n", mean, times[times.size() / 2], times.front(), times.back(), options.iterations);
+	printf("throughput: %.2f M vertices/s, %.2f M deltas/s\n", mesh.numVertices / mean / 1000.0, totalDeltas / mean / 1000.0);
+	if(topology)
+		printf("topology: %u weld groups, %zu bytes\n", topology->GetWelds().GetGroupCount(), topology->GetMemoryUsage());
+
+	if(!options.outPath.empty()) {
+		Morpher::MeshDump result = mesh;
+		result.vertexBlock = target;
+
+		std::vector<uint8_t> bytes;
+		result.Serialize(bytes);
+		if(!WriteFile(options.outPath, bytes)) {
+			fprintf(stderr, "failed to write %s\n", options.outPath.c_str());
+			return 1;
+		}
+	}
+
+	return 0;
+}